@@ -72,6 +72,28 @@ schedaddtimed(void)
     addtimedfn(checksched, schedcmds->time);
 }
 
+/**/
+#ifdef DEBUG
+
+/* Check whether sched's function is on the list of timed events */
+
+/**/
+static int
+schedfnlisted(void)
+{
+    LinkNode ln;
+
+    if (timedfns) {
+	for (ln = firstnode(timedfns); ln; ln = nextnode(ln))
+	    if (((Timedfn)getdata(ln))->func == checksched)
+		return 1;
+    }
+    return 0;
+}
+
+/**/
+#endif
+
 /* Use deltimedfn() to remove the sched timed event */
 
 /**/
@@ -138,7 +160,7 @@ checksched(void)
 	    /*
 	     * We've already delete the function from the list.
 	     */
-	    DPUTS(timedfns && firstnode(timedfns),
+	    DPUTS(schedfnlisted(),
 		  "BUG: already timed fn (1)");
 	    schedaddtimed();
 	}
@@ -179,7 +201,7 @@ bin_sched(char *nam, char **argv, UNUSED(Options ops), UNUSED(int func))
 		scheddeltimed();
 		schedcmds = sch->next;
 		if (schedcmds) {
-		    DPUTS(timedfns && firstnode(timedfns), "BUG: already timed fn (2)");
+		    DPUTS(schedfnlisted(), "BUG: already timed fn (2)");
 		    schedaddtimed();
 		}
 	    }
@@ -316,7 +338,7 @@ bin_sched(char *nam, char **argv, UNUSED(Options ops), UNUSED(int func))
 	    scheddeltimed();
 	    sch->next = schedcmds;
 	    schedcmds = sch;
-	    DPUTS(timedfns && firstnode(timedfns), "BUG: already timed fn (3)");
+	    DPUTS(schedfnlisted(), "BUG: already timed fn (3)");
 	    schedaddtimed();
 	} else {
 	    for (sch2 = schedcmds;
@@ -329,7 +351,7 @@ bin_sched(char *nam, char **argv, UNUSED(Options ops), UNUSED(int func))
     } else {
 	sch->next = NULL;
 	schedcmds = sch;
-	DPUTS(timedfns && firstnode(timedfns), "BUG: already timed fn (4)");
+	DPUTS(schedfnlisted(), "BUG: already timed fn (4)");
 	schedaddtimed();
     }
     return 0;
@@ -51,6 +51,7 @@ bin_clone(char *nam, char **args, UNUSED(Options ops), UNUSED(int func))
 	zwarnnam(nam, "%s: %e", *args, errno);
 	return 1;
     }
+    fflush(stdout);
     pid = fork();
     if (!pid) {
 	clearjobtab(0);
@@ -67,6 +68,7 @@ bin_clone(char *nam, char **args, UNUSED(Options ops), UNUSED(int func))
 	dup2(ttyfd,0);
 	dup2(ttyfd,1);
 	dup2(ttyfd,2);
+	flushstdout();
 	if (ttyfd > 2)
 	    close(ttyfd);
 	closem(FDT_UNUSED, 0);
@@ -268,8 +268,171 @@ scanpmmapfile(UNUSED(HashTable ht), ScanFunc func, int flags)
     closedir(dir);
 }
 
+/*
+ * Add an element of len bytes at str to the array being built by
+ * bin_mapfile(), metafying it on the way.
+ */
+
+/**/
+static void
+addmapline(char ***arrp, int *np, int *sizep, char *str, int len)
+{
+    if (*np + 1 >= *sizep) {
+	int newsize = *sizep * 2;
+
+	*arrp = (char **)zrealloc(*arrp, newsize * sizeof(char *));
+	*sizep = newsize;
+    }
+    (*arrp)[(*np)++] = metafy(str, len, META_DUP);
+}
+
+/*
+ * Make room for at least len bytes of a line that is still incomplete
+ * at the end of a block, doubling the space so long lines aren't
+ * copied over and over.
+ */
+
+/**/
+static void
+growmappend(char **pendp, int *sizep, int len)
+{
+    int newsize = *sizep ? *sizep : 256;
+
+    if (len <= *sizep)
+	return;
+    while (newsize < len)
+	newsize *= 2;
+    *pendp = (char *)zrealloc(*pendp, newsize);
+    *sizep = newsize;
+}
+
+/* Size of the blocks bin_mapfile() reads. */
+#define MAPLINE_BUFSIZE 65536
+
+/*
+ * mapfile [ -bt ] [ -d delim ] [ -n count ] [ -s count ] [ -u fd ] [ array ]
+ *
+ * Read lines from a file descriptor straight into an array, without
+ * building the whole of the input as a single string first.
+ */
+
+/**/
+static int
+bin_mapfile(char *nam, char **args, Options ops, UNUSED(int func))
+{
+    char *aname = *args ? *args : "MAPFILE", *eptr;
+    char *buf, *start, *end, *ptr, *pend = NULL;
+    char **arr;
+    int fd = 0, delim = '\n', rsiz, len, n = 0, asize = 16;
+    int plen = 0, psize = 0;
+    int keep = !OPT_ISSET(ops,'t'), done = 0, seekable, ret = 0, kept;
+    zlong count = 0, skip = 0;
+    off_t unused = 0;
+
+    if (OPT_HASARG(ops,'u')) {
+	fd = (int)zstrtol(OPT_ARG(ops,'u'), &eptr, 10);
+	if (*eptr || fd < 0) {
+	    zwarnnam(nam, "number expected after -u: %s", OPT_ARG(ops,'u'));
+	    return 1;
+	}
+    }
+    if (OPT_HASARG(ops,'n')) {
+	count = zstrtol(OPT_ARG(ops,'n'), &eptr, 10);
+	if (*eptr || count < 0) {
+	    zwarnnam(nam, "number expected after -n: %s", OPT_ARG(ops,'n'));
+	    return 1;
+	}
+    }
+    if (OPT_HASARG(ops,'s')) {
+	skip = zstrtol(OPT_ARG(ops,'s'), &eptr, 10);
+	if (*eptr || skip < 0) {
+	    zwarnnam(nam, "number expected after -s: %s", OPT_ARG(ops,'s'));
+	    return 1;
+	}
+    }
+    if (OPT_HASARG(ops,'d')) {
+	char *dstr = OPT_ARG(ops,'d');
+
+	delim = STOUC(*dstr == Meta ? dstr[1] ^ 32 : *dstr);
+    }
+
+    /*
+     * If we may stop before the end of the input we mustn't read
+     * more than we use, unless we can seek back afterwards or -b
+     * says to keep what's left over for the next read or mapfile
+     * on the descriptor.  Anything an earlier one kept comes first.
+     */
+    seekable = lseek(fd, 0, SEEK_CUR) != (off_t)-1;
+    rsiz = (count && !seekable && !OPT_ISSET(ops,'b')) ?
+	1 : MAPLINE_BUFSIZE;
+    buf = (char *)zalloc(MAPLINE_BUFSIZE);
+    arr = (char **)zalloc(asize * sizeof(char *));
+
+    while (!done) {
+	if ((len = zreadtake(fd, buf, MAPLINE_BUFSIZE)))
+	    kept = 1;
+	else if ((kept = 0, len = read(fd, buf, rsiz)) < 0) {
+	    if (errno == EINTR && !errflag)
+		continue;
+	    zwarnnam(nam, "read failed: %e", errno);
+	    ret = 1;
+	    break;
+	}
+	if (!len || errflag)
+	    break;
+	for (start = buf, end = buf + len; start < end; start = ptr + 1) {
+	    if (!(ptr = memchr(start, delim, end - start))) {
+		/* Incomplete line: save it for next time round. */
+		growmappend(&pend, &psize, plen + (end - start));
+		memcpy(pend + plen, start, end - start);
+		plen += end - start;
+		break;
+	    }
+	    if (skip)
+		skip--;
+	    else if (plen) {
+		growmappend(&pend, &psize, plen + (ptr - start) + 1);
+		memcpy(pend + plen, start, ptr - start + 1);
+		addmapline(&arr, &n, &asize, pend,
+			   plen + (ptr - start) + keep);
+	    } else
+		addmapline(&arr, &n, &asize, start, ptr - start + keep);
+	    plen = 0;
+	    if (count && n == count) {
+		unused = end - (ptr + 1);
+		done = 1;
+		break;
+	    }
+	}
+    }
+    /* A final line without a delimiter still counts. */
+    if (plen && !done && !ret) {
+	if (skip)
+	    skip--;
+	else
+	    addmapline(&arr, &n, &asize, pend, plen);
+    }
+    if (unused && (kept || !seekable ||
+		   lseek(fd, -unused, SEEK_CUR) == (off_t)-1))
+	zreadkeep(fd, end - unused, (int)unused);
+    if (pend)
+	zfree(pend, psize);
+    zfree(buf, MAPLINE_BUFSIZE);
+    arr[n] = NULL;
+
+    if (ret || errflag) {
+	freearray(arr);
+	return 1;
+    }
+    return !setaparam(aname, arr);
+}
+
+static struct builtin bintab[] = {
+    BUILTIN("mapfile", 0, bin_mapfile, 0, 1, 0, "bd:n:s:tu:", NULL)
+};
+
 static struct features module_features = {
-    NULL, 0,
+    bintab, sizeof(bintab)/sizeof(*bintab),
     NULL, 0,
     NULL, 0,
     partab, sizeof(partab)/sizeof(*partab),
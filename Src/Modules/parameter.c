@@ -1226,6 +1226,7 @@ histwgetfn(UNUSED(Param pm))
             pushnode(l, getdata(n));
 
     while (he) {
+	histentwords(he);
 	for (iw = he->nwords - 1; iw >= 0; iw--) {
 	    h = he->node.nam + he->words[iw * 2];
 	    e = he->node.nam + he->words[iw * 2 + 1];
@@ -326,6 +326,7 @@ newptycmd(char *nam, char *pname, char **args, int echo, int nblock)
 	ineval = oineval;
 	return 1;
     }
+    fflush(stdout);
     if ((pid = fork()) == -1) {
 	zwarnnam(nam, "can't create pty command %s: %e", pname, errno);
 	close(master);
@@ -399,6 +400,7 @@ newptycmd(char *nam, char *pname, char **args, int echo, int nblock)
 	dup2(slave, 0);
 	dup2(slave, 1);
 	dup2(slave, 2);
+	flushstdout();
 
 	closem(FDT_UNUSED, 0);
 	close(slave);
@@ -3815,6 +3815,7 @@ makecomplistflags(Compctl cc, char *s, int incmd, int compadd)
 	/* Now search the history. */
 	while (n-- && he) {
 	    int iwords;
+	    histentwords(he);
 	    for (iwords = he->nwords - 1; iwords >= 0; iwords--) {
 		h = he->node.nam + he->words[iwords*2];
 		e = he->node.nam + he->words[iwords*2+1];
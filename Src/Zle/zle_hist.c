@@ -81,6 +81,7 @@ remember_edits(void)
 	    if (ent->zle_text)
 		free(ent->zle_text);
 	    ent->zle_text = zlemetaline ? ztrdup(line) : line;
+	    ent->node.flags &= ~HIST_ZLESIG;
 	} else if (!zlemetaline)
 	    free(line);
     }
@@ -96,6 +97,7 @@ forget_edits(void)
 	if (he->zle_text) {
 	    free(he->zle_text);
 	    he->zle_text = NULL;
+	    he->node.flags &= ~HIST_ZLESIG;
 	}
     }
 }
@@ -212,6 +214,65 @@ zlinefind(char *haystack, int pos, char *needle, int dir, int sens)
     return NULL;
 }
 
+/*
+ * Searches through the history look for a needle in a great many
+ * lines which mostly don't contain it.  To reject those quickly, each
+ * history entry caches a signature of its zle text with one bit for
+ * each hashed pair of adjacent characters; if the needle occurs in the
+ * line, every bit in the needle's signature is also set in the line's.
+ * Letters are folded to lower case so the same signature serves
+ * searches ignoring case.  Pairs with a byte outside ASCII are not
+ * hashed; instead the top bit records that the line has such bytes,
+ * since case folding of a multibyte character may produce ASCII.
+ */
+
+#define ZLESIG_BITS	(8 * (int)sizeof(zulong) - 1)
+#define ZLESIG_NONASCII	((zulong)1 << ZLESIG_BITS)
+
+static zulong
+zlinesig(char *s)
+{
+    zulong sig = 0;
+
+    for (; *s; s++) {
+	unsigned char c1 = STOUC(s[0]), c2 = STOUC(s[1]);
+
+	if ((c1 | c2) & 0x80)
+	    sig |= ZLESIG_NONASCII;
+	else if (c2)
+	    sig |= (zulong)1 << ((tulower(c1) * 31 + tulower(c2))
+				 % ZLESIG_BITS);
+    }
+    return sig;
+}
+
+/*
+ * Return 0 if the zle text of he can't contain a string with
+ * signature sig (see zlinesig()), where sens is as for zlinefind().
+ */
+
+static int
+zlinesigmatch(Histent he, zulong sig, int sens)
+{
+    zulong hsig;
+
+    if (!(sig &= ~ZLESIG_NONASCII))
+	return 1;
+    if (he->histnum == curhist) {
+	/* the line being edited changes under us, don't cache it */
+	hsig = zlinesig(GETZLETEXT(he));
+    } else {
+	if (!(he->node.flags & HIST_ZLESIG)) {
+	    he->zle_sig = zlinesig(GETZLETEXT(he));
+	    he->node.flags |= HIST_ZLESIG;
+	}
+	hsig = he->zle_sig;
+    }
+    if (sens > 1 && (hsig & ZLESIG_NONASCII))
+	return 1;
+    return (hsig & sig) == sig;
+}
+
 
 /*** Widgets ***/
 
@@ -684,7 +745,9 @@ insertlastword(char **args)
 	nwords = countlinknodes(l);
     } else {
 	/* Some stored line. */
-	if (!(he = quietgethist(evhist)) || !he->nwords) {
+	if ((he = quietgethist(evhist)))
+	    histentwords(he);
+	if (!he || !he->nwords) {
 	    unmetafy_line();
 	    return 1;
 	}
@@ -1212,9 +1275,11 @@ doisearch(char **args, int dir, int pattern)
 	} else if (sbptr > 0) {
 	    /* The matched text, used as flag that we matched */
 	    char *t = NULL;
+	    zulong sig;
 	    last_line = zt;
 
 	    sbuf[sbptr] = '\0';
+	    sig = zlinesig(sbuf[0] == '^' ? sbuf + 1 : sbuf);
 	    if (pattern && !patprog && !nosearch) {
 		/* avoid too much heap use, can get heavy round here... */
 		char *patbuf = ztrdup(sbuf);
@@ -1373,7 +1438,7 @@ doisearch(char **args, int dir, int pattern)
 		     * First search for a(nother) match within the
 		     * current line, unless we've been told to skip it.
 		     */
-		    if (!skip_line) {
+		    if (!skip_line && zlinesigmatch(he, sig, sens)) {
 			if (sbuf[0] == '^') {
 			    if (zlinecmp(zt, sbuf + 1) < sens)
 				t = zt;
@@ -1961,6 +2026,7 @@ virepeatsearch(UNUSED(char **args))
     Histent he;
     int n = zmult;
     char *zt;
+    zulong sig;
 
     if (!visrchstr)
 	return 1;
@@ -1971,9 +2037,12 @@ virepeatsearch(UNUSED(char **args))
     if (!(he = quietgethist(histline)))
 	return 1;
     metafy_line();
+    sig = zlinesig(*visrchstr == '^' ? visrchstr + 1 : visrchstr);
     while ((he = movehistent(he, visrchsense, hist_skip_flags))) {
 	if (isset(HISTFINDNODUPS) && he->node.flags & HIST_DUP)
 	    continue;
+	if (!zlinesigmatch(he, sig, 1))
+	    continue;
 	zt = GETZLETEXT(he);
 	if (zlinecmp(zt, zlemetaline) &&
 	    (*visrchstr == '^' ? strpfx(visrchstr + 1, zt) :
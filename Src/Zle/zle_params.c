@@ -95,6 +95,10 @@ static const struct gsu_integer pending_gsu =
 { get_pending, NULL, zleunsetfn };
 static const struct gsu_integer recursive_gsu =
 { get_recursive, NULL, zleunsetfn };
+static const struct gsu_integer refreshbytes_gsu =
+{ get_refreshbytes, NULL, zleunsetfn };
+static const struct gsu_integer refreshwrites_gsu =
+{ get_refreshwrites, NULL, zleunsetfn };
 static const struct gsu_integer region_active_gsu =
 { get_region_active, set_region_active, zleunsetfn };
 static const struct gsu_integer undo_change_no_gsu =
@@ -183,6 +187,10 @@ static struct zleparam {
     { "SUFFIX_END", PM_INTEGER, GSU(suffixend_gsu), NULL },
     { "SUFFIX_ACTIVE", PM_INTEGER | PM_READONLY, GSU(suffixactive_gsu), NULL },
     { "ZLE_RECURSIVE", PM_INTEGER | PM_READONLY, GSU(recursive_gsu), NULL },
+    { "ZLE_REFRESH_BYTES", PM_INTEGER | PM_READONLY, GSU(refreshbytes_gsu),
+      NULL },
+    { "ZLE_REFRESH_WRITES", PM_INTEGER | PM_READONLY, GSU(refreshwrites_gsu),
+      NULL },
     { "ZLE_STATE", PM_SCALAR | PM_READONLY, GSU(zle_state_gsu), NULL },
     { NULL, 0, NULL, NULL }
 };
@@ -536,6 +544,20 @@ get_recursive(UNUSED(Param pm))
     return zle_recursive;
 }
 
+/**/
+static zlong
+get_refreshbytes(UNUSED(Param pm))
+{
+    return refreshbytes;
+}
+
+/**/
+static zlong
+get_refreshwrites(UNUSED(Param pm))
+{
+    return refreshwrites;
+}
+
 /**/
 static zlong
 get_yankstart(UNUSED(Param pm))
@@ -27,6 +27,9 @@
  *
  */
 
+/* this is defined so we get the prototype for open_memstream */
+#define _GNU_SOURCE 1
+
 #include "zle.mdh"
 
 #ifdef MULTIBYTE_SUPPORT
@@ -386,6 +389,51 @@ zle_free_highlight(void)
     free_colour_buffer();
 }
 
+/*
+ * The attribute parts of the entries last assigned to region_highlight
+ * and the attributes parsed from them.  Highlighting code usually
+ * assigns the whole array again after each change to the line while
+ * most entries keep their attributes, so only attribute specifications
+ * that differ from those at the same index last time need parsing.
+ * The strings point into region_highlight_vals, the array last
+ * assigned, which is kept for the purpose.  The formatted attributes
+ * are remembered, too, for when the array is read back.
+ *
+ * The parsed attributes may depend on the terminal and on the hooks
+ * for colours, so all of this is forgotten when the line editor
+ * finishes with a line or the number of colours changes.
+ */
+
+struct region_spec {
+    /* Attribute part of the entry */
+    char *spec;
+    /* Attributes parsed from spec */
+    zattr atr;
+    /* Attributes formatted for output, if needed yet */
+    char *out;
+};
+
+static struct region_spec *region_specs;
+static int n_region_specs, region_specs_colours;
+static char **region_highlight_vals;
+
+/**/
+static void
+free_region_specs(void)
+{
+    int i;
+
+    for (i = 0; i < n_region_specs; i++)
+	zsfree(region_specs[i].out);
+    if (region_specs)
+	zfree(region_specs, n_region_specs * sizeof(struct region_spec));
+    if (region_highlight_vals)
+	freearray(region_highlight_vals);
+    region_specs = NULL;
+    n_region_specs = 0;
+    region_highlight_vals = NULL;
+}
+
 /*
  * Interface to the region_highlight ZLE parameter.
  * Converts between a format like "P32 42 underline,bold" to
@@ -398,7 +446,7 @@ zle_free_highlight(void)
 char **
 get_region_highlight(UNUSED(Param pm))
 {
-    int arrsize = n_region_highlights;
+    int arrsize = n_region_highlights, ireg;
     char **retarr, **arrp;
     struct region_highlight *rhp;
 
@@ -410,17 +458,27 @@ get_region_highlight(UNUSED(Param pm))
     arrp = retarr = (char **)zhalloc((arrsize+1)*sizeof(char *));
 
     /* ignore special highlighting */
-    for (rhp = region_highlights + N_SPECIAL_HIGHLIGHTS;
-	 arrsize--;
-	 rhp++, arrp++) {
+    for (rhp = region_highlights + N_SPECIAL_HIGHLIGHTS, ireg = 0;
+	 ireg < arrsize;
+	 rhp++, arrp++, ireg++) {
 	char digbuf1[DIGBUFSIZE], digbuf2[DIGBUFSIZE];
-	int atrlen = 0, alloclen;
+	char *atrstr;
+	int alloclen;
 
 	sprintf(digbuf1, "%d", rhp->start);
 	sprintf(digbuf2, "%d", rhp->end);
 
-	atrlen = output_highlight(rhp->atr, NULL);
-	alloclen = atrlen + strlen(digbuf1) + strlen(digbuf2) +
+	if (ireg < n_region_specs && region_specs[ireg].atr == rhp->atr &&
+	    region_specs[ireg].out)
+	    atrstr = region_specs[ireg].out;
+	else {
+	    atrstr = (char *)zhalloc(output_highlight(rhp->atr, NULL) + 1);
+	    *atrstr = '\0';
+	    (void)output_highlight(rhp->atr, atrstr);
+	    if (ireg < n_region_specs && region_specs[ireg].atr == rhp->atr)
+		region_specs[ireg].out = ztrdup(atrstr);
+	}
+	alloclen = strlen(atrstr) + strlen(digbuf1) + strlen(digbuf2) +
 	    3; /* 2 spaces, 1 0 */
 	if (rhp->flags & ZRH_PREDISPLAY)
 	    alloclen += 2; /* "P " */
@@ -432,10 +490,9 @@ get_region_highlight(UNUSED(Param pm))
 	 * into three words, and then check the first to
 	 * see if there are flags.  However, it's arguable.
 	 */
-	sprintf(*arrp, "%s%s %s ",
+	sprintf(*arrp, "%s%s %s %s",
 		(rhp->flags & ZRH_PREDISPLAY) ? "P" : "",
-		digbuf1, digbuf2);
-	(void)output_highlight(rhp->atr, *arrp + strlen(*arrp));
+		digbuf1, digbuf2, atrstr);
     }
     *arrp = NULL;
     return retarr;
@@ -454,6 +511,7 @@ set_region_highlight(UNUSED(Param pm), char **aval)
     int len;
     char **av = aval;
     struct region_highlight *rhp;
+    struct region_spec *newspecs, *newp;
 
     len = aval ? arrlen(aval) : 0;
     if (n_region_highlights != len + N_SPECIAL_HIGHLIGHTS) {
@@ -469,13 +527,22 @@ set_region_highlight(UNUSED(Param pm), char **aval)
 	n_region_highlights = newsize;
     }
 
-    if (!aval)
+    if (!aval) {
+	free_region_specs();
 	return;
+    }
+    if (region_specs_colours != tccolours) {
+	free_region_specs();
+	region_specs_colours = tccolours;
+    }
+    newspecs = len ? (struct region_spec *)
+	zalloc(len * sizeof(struct region_spec)) : NULL;
 
-    for (rhp = region_highlights + N_SPECIAL_HIGHLIGHTS;
+    for (rhp = region_highlights + N_SPECIAL_HIGHLIGHTS, newp = newspecs;
 	 *aval;
-	 rhp++, aval++) {
+	 rhp++, aval++, newp++) {
 	char *strp, *oldstrp;
+	int ireg = newp - newspecs;
 
 	oldstrp = *aval;
 	if (*oldstrp == 'P') {
@@ -502,10 +569,23 @@ set_region_highlight(UNUSED(Param pm), char **aval)
 	while (inblank(*strp))
 	    strp++;
 
-	match_highlight(strp, &rhp->atr);
+	newp->spec = strp;
+	newp->out = NULL;
+	if (ireg < n_region_specs && !strcmp(strp, region_specs[ireg].spec)) {
+	    newp->atr = region_specs[ireg].atr;
+	    newp->out = region_specs[ireg].out;
+	    region_specs[ireg].out = NULL;
+	} else if (ireg && !strcmp(strp, newp[-1].spec))
+	    newp->atr = newp[-1].atr;
+	else
+	    match_highlight(strp, &newp->atr);
+	rhp->atr = newp->atr;
     }
 
-    freearray(av);
+    free_region_specs();
+    region_specs = newspecs;
+    n_region_specs = len;
+    region_highlight_vals = av;
 }
 
 
@@ -520,6 +600,77 @@ unset_region_highlight(Param pm, int exp)
 }
 
 
+/*
+ * Work out the attributes region highlighting gives each of the tmpll
+ * characters of the line, starting from base.  The first tmpll elements
+ * of the array returned are the attributes turned on, the next tmpll
+ * those to turn off after the character; the array should be freed
+ * with zfree() by the caller.  If keepcolour is set, the first region to
+ * give a character a colour wins, else the last.
+ *
+ * Each region is applied in turn to the characters it covers, so the
+ * work depends on the number of regions and the text they cover rather
+ * than the number of regions times the length of the line.
+ */
+
+/**/
+static zattr *
+region_attributes(int tmpll, zattr base, int keepcolour)
+{
+    zattr *atrs, *atroff;
+    struct region_highlight *rhp;
+    int i;
+
+    if (!tmpll)
+	return NULL;
+    atrs = (zattr *)zalloc(2 * tmpll * sizeof(zattr));
+    atroff = atrs + tmpll;
+    for (i = 0; i < tmpll; i++) {
+	atrs[i] = base;
+	atroff[i] = 0;
+    }
+
+    for (rhp = region_highlights;
+	 rhp < region_highlights + n_region_highlights;
+	 rhp++) {
+	int offset, pos, end;
+	zattr atr = rhp->atr;
+
+	if (rhp->flags & ZRH_PREDISPLAY)
+	    offset = 0;	/* include predisplay in start end */
+	else
+	    offset = predisplaylen; /* increment over it */
+	pos = rhp->start + offset;
+	end = rhp->end + offset;
+	if (pos < 0)
+	    pos = 0;
+	if (end > tmpll)
+	    end = tmpll;
+	if (pos >= end)
+	    continue;
+	for (; pos < end; pos++) {
+	    if (keepcolour) {
+		if (atrs[pos] & (TXTFGCOLOUR|TXTBGCOLOUR)) {
+		    /* keep colour already set */
+		    atrs[pos] |= atr & ~TXT_ATTR_COLOUR_ON_MASK;
+		} else {
+		    /* no colour set yet */
+		    atrs[pos] |= atr;
+		}
+	    } else if (atr & (TXTFGCOLOUR|TXTBGCOLOUR)) {
+		/* override colour with later entry */
+		atrs[pos] = (atrs[pos] & ~TXT_ATTR_ON_VALUES_MASK) | atr;
+	    } else {
+		/* no colour set yet */
+		atrs[pos] |= atr;
+	    }
+	}
+	atroff[end - 1] |= TXT_ATTR_OFF_FROM_ON(atr);
+    }
+
+    return atrs;
+}
+
 /* The last attributes that were on. */
 static zattr lastatr;
 
@@ -977,6 +1128,83 @@ bufswap(void)
 }
 
 
+#ifdef HAVE_OPEN_MEMSTREAM
+/*
+ * While a screen update is being worked out, the output goes to a
+ * memory stream in place of shout; the terminal is given it with
+ * a single write() at the end.  Otherwise a large update, such as one
+ * with a lot of highlighting, would go out in pieces the size of the
+ * stdio buffer, each of them its own packet over a network.
+ */
+
+static FILE *frameshout;	/* the real shout while that happens */
+static char *framebuf;
+static size_t framelen;
+#endif
+
+/*
+ * Count of bytes and of write() calls used to send screen updates
+ * to the terminal, which can be examined from widgets.
+ */
+
+/**/
+zlong refreshbytes, refreshwrites;
+
+/* Start collecting the output for an update; return 1 if we did */
+
+static int
+startframe(void)
+{
+#ifdef HAVE_OPEN_MEMSTREAM
+    FILE *ms;
+
+    if (frameshout || !shout || !(ms = open_memstream(&framebuf, &framelen)))
+	return 0;
+    fflush(shout);
+    frameshout = shout;
+    shout = ms;
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/* Send the output for an update to the terminal */
+
+static void
+endframe(int started)
+{
+#ifdef HAVE_OPEN_MEMSTREAM
+    if (started) {
+	FILE *ms = shout;
+	char *ptr;
+	size_t len;
+	ssize_t ret;
+
+	shout = frameshout;
+	frameshout = NULL;
+	/* As in bin_print(), close the stream before using the buffer */
+	if (fclose(ms) == 0) {
+	    for (ptr = framebuf, len = framelen; len; ) {
+		refreshwrites++;
+		if ((ret = write(fileno(shout), ptr, len)) < 0) {
+		    if (errno == EINTR)
+			continue;
+		    break;
+		}
+		refreshbytes += ret;
+		ptr += ret;
+		len -= ret;
+	    }
+	}
+	free(framebuf);
+	framebuf = NULL;
+	return;
+    }
+#endif
+    fflush(shout);
+}
+
 /**/
 mod_export void
 zrefresh(void)
@@ -994,6 +1222,8 @@ zrefresh(void)
     int remetafy;		/* flag that zle line is metafied	     */
     zattr txtchange;		/* attributes set after prompts              */
     int rprompt_off = 1;	/* Offset of rprompt from right of screen    */
+    int frame;			/* flag that output is collected in memory   */
+    zattr *regatrs;		/* attributes from region highlighting	     */
     struct rparams rpms;
 #ifdef MULTIBYTE_SUPPORT
     int width;			/* width of wide character		     */
@@ -1007,6 +1237,8 @@ zrefresh(void)
     if (inlist)
 	return;
 
+    frame = startframe();
+
     /*
      * zrefresh() is called from all over the place, so we can't
      * be sure if the line is metafied for completion or not.
@@ -1211,37 +1443,13 @@ zrefresh(void)
 
     rpms.s = nbuf[rpms.ln = 0] + lpromptw;
     rpms.sen = *nbuf + winw;
+    regatrs = region_attributes(tmpll, default_atr_on, 0);
     for (t = tmpline, tmppos = 0; tmppos < tmpll; t++, tmppos++) {
-	unsigned ireg;
-	zattr base_atr_on = default_atr_on, base_atr_off = 0;
+	/* Attributes based on region */
+	zattr base_atr_on = regatrs[tmppos];
+	zattr base_atr_off = regatrs[tmpll + tmppos];
 	zattr all_atr_on, all_atr_off;
-	struct region_highlight *rhp;
-	/*
-	 * Calculate attribute based on region.
-	 */
-	for (ireg = 0, rhp = region_highlights;
-	     ireg < n_region_highlights;
-	     ireg++, rhp++) {
-	    int offset;
-	    if (rhp->flags & ZRH_PREDISPLAY)
-		offset = 0;	/* include predisplay in start end */
-	    else
-		offset = predisplaylen; /* increment over it */
-	    if (rhp->start + offset <= tmppos &&
-		tmppos < rhp->end + offset) {
-		if (rhp->atr & (TXTFGCOLOUR|TXTBGCOLOUR)) {
-		    /* override colour with later entry */
-		    base_atr_on = (base_atr_on & ~TXT_ATTR_ON_VALUES_MASK) |
-			rhp->atr;
-		} else {
-		    /* no colour set yet */
-		    base_atr_on |= rhp->atr;
-		}
-		if (tmppos == rhp->end + offset - 1 ||
-		    tmppos == tmpll - 1)
-		    base_atr_off |= TXT_ATTR_OFF_FROM_ON(rhp->atr);
-	    }
-	}
+
 	if (special_atr_on & (TXTFGCOLOUR|TXTBGCOLOUR)) {
 	    /* keep colours from special attributes */
 	    all_atr_on = special_atr_on |
@@ -1432,6 +1640,8 @@ zrefresh(void)
 		break;
 	}
     }
+    if (regatrs)
+	zfree(regatrs, 2 * tmpll * sizeof(zattr));
 
 /* if we're really on the next line, don't fake it; do everything properly */
     if (t == scs &&
@@ -1750,7 +1960,7 @@ individually */
     if (nlnct > vmaxln)
 	vmaxln = nlnct;
 singlelineout:
-    fflush(shout);		/* make sure everything is written out */
+    endframe(frame);		/* make sure everything is written out */
 
     if (tmpalloced)
 	zfree(tmpline, tmpll * sizeof(*tmpline));
@@ -2460,6 +2670,7 @@ singlerefresh(ZLE_STRING_T tmpline, int tmpll, int tmpcs)
 	nvcs = 0,		/* new video cursor column     */
 	owinpos = winpos,	/* previous window position    */
 	owinprompt = winprompt;	/* previous winprompt          */
+    zattr *regatrs;		/* region highlighting         */
 #ifdef MULTIBYTE_SUPPORT
     int width;			/* width of multibyte character */
 #endif
@@ -2507,36 +2718,12 @@ singlerefresh(ZLE_STRING_T tmpline, int tmpll, int tmpcs)
     vp = vbuf + lpromptw;
     *vp = zr_zr;
 
+    regatrs = region_attributes(tmpll, 0, 1);
     for (t0 = 0; t0 < tmpll; t0++) {
-	unsigned ireg;
-	zattr base_atr_on = 0, base_atr_off = 0;
+	/* Attributes based on region */
+	zattr base_atr_on = regatrs[t0], base_atr_off = regatrs[tmpll + t0];
 	zattr all_atr_on, all_atr_off;
-	struct region_highlight *rhp;
-	/*
-	 * Calculate attribute based on region.
-	 */
-	for (ireg = 0, rhp = region_highlights;
-	     ireg < n_region_highlights;
-	     ireg++, rhp++) {
-	    int offset;
-	    if (rhp->flags & ZRH_PREDISPLAY)
-		offset = 0;	/* include predisplay in start end */
-	    else
-		offset = predisplaylen; /* increment over it */
-	    if (rhp->start + offset <= t0 &&
-		t0 < rhp->end + offset) {
-		if (base_atr_on & (TXTFGCOLOUR|TXTBGCOLOUR)) {
-		    /* keep colour already set */
-		    base_atr_on |= rhp->atr & ~TXT_ATTR_COLOUR_ON_MASK;
-		} else {
-		    /* no colour set yet */
-		    base_atr_on |= rhp->atr;
-		}
-		if (t0 == rhp->end + offset - 1 ||
-		    t0 == tmpll - 1)
-		    base_atr_off |= TXT_ATTR_OFF_FROM_ON(rhp->atr);
-	    }
-	}
+
 	if (special_atr_on & (TXTFGCOLOUR|TXTBGCOLOUR)) {
 	    /* keep colours from special attributes */
 	    all_atr_on = special_atr_on |
@@ -2635,6 +2822,8 @@ singlerefresh(ZLE_STRING_T tmpline, int tmpll, int tmpcs)
 	if (t0 == tmpcs)
 	    nvcs = vp - vbuf - 1;
     }
+    if (regatrs)
+	zfree(regatrs, 2 * tmpll * sizeof(zattr));
     if (t0 == tmpcs)
 	nvcs = vp - vbuf;
     *vp = zr_zr;
@@ -2802,4 +2991,5 @@ zle_refresh_finish(void)
 	region_highlights = NULL;
 	n_region_highlights = 0;
     }
+    free_region_specs();
 }
@@ -107,7 +107,7 @@ static struct builtin builtins[] =
     BUILTIN("pushln", 0, bin_print, 0, -1, BIN_PRINT, NULL, "-nz"),
     BUILTIN("pwd", 0, bin_pwd, 0, 0, 0, "rLP", NULL),
     BUILTIN("r", 0, bin_fc, 0, -1, BIN_R, "IlLnr", NULL),
-    BUILTIN("read", 0, bin_read, 0, -1, 0, "cd:ek:%lnpqrst:%zu:AE", NULL),
+    BUILTIN("read", 0, bin_read, 0, -1, 0, "bcd:ek:%lnpqrst:%zu:AE", NULL),
     BUILTIN("readonly", BINF_PLUSOPTS | BINF_MAGICEQUALS | BINF_PSPECIAL | BINF_ASSIGN, (HandlerFunc)bin_typeset, 0, -1, BIN_READONLY, "AE:%F:%HL:%R:%TUZ:%afghi:%lptux", "r"),
     BUILTIN("rehash", 0, bin_hash, 0, 0, 0, "df", "r"),
     BUILTIN("return", BINF_PSPECIAL, bin_break, 0, 1, BIN_RETURN, NULL, NULL),
@@ -4476,7 +4476,9 @@ bin_print(char *name, char **args, Options ops, int func)
     /* Testing EBADF special-cases >&- redirections */
 #define CLOSE_CLEANLY(FOUT) \
     (IS_MSTREAM(FOUT) ? CLOSE_MSTREAM(FOUT) == 0 : \
-     ((FOUT == stdout) ? (fflush(FOUT) == 0 || errno == EBADF) : \
+     ((FOUT == stdout) ? \
+      ((stdoutlazy() ? !ferror(FOUT) : fflush(FOUT) == 0) || \
+       errno == EBADF) : \
       (fclose(FOUT) == 0)))	/* implies error for -u on a closed fd */
 
     Histent ent;
@@ -4670,6 +4672,7 @@ bin_print(char *name, char **args, Options ops, int func)
 	    }
 	}
 
+	fflush(stdout);
 	if ((fd = dup(fdarg)) < 0) {
 	    zwarnnam(name, "bad file number: %d", fdarg);
 	    return 1;
@@ -5779,6 +5782,7 @@ realexit(void)
 void
 _realexit(void)
 {
+    fflush(stdout);
     _exit((shell_exiting || exit_pending) ? exit_val : lastval);
 }
 
@@ -5832,6 +5836,8 @@ zexit(int val, enum zexit_t from_where)
 	/* send SIGHUP to any jobs left running  */
 	killrunjobs(from_where == ZEXIT_SIGNAL);
     }
+    /* Incremental history writes are due whether or not we save below */
+    flushhistsave();
     if (isset(RCS) && interact) {
 	if (!nohistsave) {
 	    int writeflags = HFILE_USE_OPTIONS;
@@ -5861,9 +5867,10 @@ zexit(int val, enum zexit_t from_where)
     if (opts[MONITOR] && interact && (SHTTY != -1)) {
        release_pgrp();
     }
-    if (mypid != getpid())
+    if (mypid != getpid()) {
+	fflush(stdout);
 	_exit(exit_val);
-    else
+    } else
 	exit(exit_val);
 }
 
@@ -6212,6 +6219,33 @@ bin_eval(UNUSED(char *nam), char **argv, UNUSED(Options ops), UNUSED(int func))
 static char *zbuf;
 static int readfd;
 
+/*
+ * When read is taking lines from a regular file, or from anything with
+ * -b, input is read from readfd a block at a time into readbuf rather
+ * than a byte at a time.  Once the line has been read, zreadfinish()
+ * seeks a file back to just after the last character used.  Other file
+ * descriptors can't do that, so any data left over is saved in
+ * readbufs[readfd] for the next read on that file descriptor; the
+ * device and inode are checked then in case the descriptor has been
+ * reused in the meantime.
+ */
+
+#define READBUFSIZE 8192
+
+struct readbuf {
+    char *buf;			/* size bytes, or NULL if unused          */
+    int size;			/* at least READBUFSIZE                   */
+    int len, pos;		/* bytes in buf, and bytes already used   */
+    int seek;			/* seek back over unused data when done   */
+    int refill;			/* read more blocks when buf is empty     */
+    dev_t dev;			/* identify the file of the descriptor    */
+    ino_t ino;
+};
+
+static struct readbuf readbuf;
+static struct readbuf *readbufs;
+static int readbufsz;
+
 /* Read a character from readfd, or from the buffer zbuf.  Return EOF on end of
 file/buffer. */
 
@@ -6267,6 +6301,9 @@ bin_read(char *name, char **args, Options ops, UNUSED(int func))
     if(OPT_ISSET(ops,'l') || OPT_ISSET(ops,'c'))
 	return compctlreadptr(name, args, ops, reply);
 
+    /* whatever we're reading may be waiting for our output */
+    fflush(stdout);
+
     if ((OPT_ISSET(ops,'k') || OPT_ISSET(ops,'q')) &&
 	!OPT_ISSET(ops,'u') && !OPT_ISSET(ops,'p')) {
 	if (!zleactive) {
@@ -6419,8 +6456,9 @@ bin_read(char *name, char **args, Options ops, UNUSED(int func))
 #endif
 	} else {
 	    if (readfd == -1 ||
-		!read_poll(readfd, &readchar, keys && !zleactive,
-			   timeout)) {
+		(!zreadsaved(readfd) &&
+		 !read_poll(readfd, &readchar, keys && !zleactive,
+			    timeout))) {
 		if (keys && !zleactive && !isem)
 		    settyinfo(&shttyinfo);
 		else if (resettty && SHTTY != -1)
@@ -6576,6 +6614,8 @@ bin_read(char *name, char **args, Options ops, UNUSED(int func))
 
     zbuforig = zbuf = (!OPT_ISSET(ops,'z')) ? NULL :
 	(nonempty(bufstack)) ? (char *) getlinknode(bufstack) : ztrdup("");
+    if (!zbuf && !izle)
+	zreadinit(OPT_ISSET(ops,'b'));
     first = 1;
     bslash = 0;
     while (*args || (OPT_ISSET(ops,'A') && !gotnl)) {
@@ -6758,6 +6798,7 @@ bin_read(char *name, char **args, Options ops, UNUSED(int func))
 	char **pp, **p = NULL;
 	LinkNode n;
 
+	zreadfinish();
 	p = (OPT_ISSET(ops,'e') ? (char **)NULL
 	     : (char **)zalloc((al + 1) * sizeof(char *)));
 
@@ -6885,6 +6926,7 @@ bin_read(char *name, char **args, Options ops, UNUSED(int func))
 	}
 	signal_setmask(s);
     }
+    zreadfinish();
 #ifdef MULTIBYTE_SUPPORT
     if (ret != MB_INCOMPLETE)
 	bptr = laststart;
@@ -6965,13 +7007,17 @@ zread(int izle, int *readchar, long izle_timeout)
 	*readchar = -1;
 	return STOUC(cc);
     }
+    if (readbuf.buf && readbuf.pos < readbuf.len)
+	return STOUC(readbuf.buf[readbuf.pos++]);
     for (;;) {
-	/* read a character from readfd */
-	ret = read(readfd, &cc, 1);
+	/* read a character, or a block if we can, from readfd */
+	if (readbuf.buf && readbuf.refill)
+	    ret = read(readfd, readbuf.buf, READBUFSIZE);
+	else
+	    ret = read(readfd, &cc, 1);
 	switch (ret) {
-	case 1:
-	    /* return the character read */
-	    return STOUC(cc);
+	case 0:
+	    break;
 	case -1:
 #if defined(EAGAIN) || defined(EWOULDBLOCK)
 	    if (!retry && readfd == 0 && (
@@ -6992,11 +7038,167 @@ zread(int izle, int *readchar, long izle_timeout)
 		if (errno == EINTR && !(errflag || retflag || breaks || contflag))
 		    continue;
 	    break;
+	default:
+	    /* return the character read */
+	    if (readbuf.buf && readbuf.refill) {
+		readbuf.len = ret;
+		readbuf.pos = 1;
+		cc = *readbuf.buf;
+	    }
+	    return STOUC(cc);
 	}
 	return EOF;
     }
 }
 
+/* Test if an earlier read -b left data waiting for fd. */
+
+/**/
+static int
+zreadsaved(int fd)
+{
+    struct readbuf *ra;
+    struct stat st;
+
+    if (fd < 0 || fd >= readbufsz || !(ra = readbufs + fd)->buf)
+	return 0;
+    if (!fstat(fd, &st) && st.st_dev == ra->dev && st.st_ino == ra->ino)
+	return 1;
+    zfree(ra->buf, ra->size);
+    ra->buf = NULL;
+    return 0;
+}
+
+/*
+ * Set up readbuf for reading lines from readfd.  keep is set for
+ * read -b, when we read blocks even if we can't seek back.
+ */
+
+/**/
+static void
+zreadinit(int keep)
+{
+    struct stat st;
+
+    readbuf.buf = NULL;
+    if (zreadsaved(readfd)) {
+	readbuf = readbufs[readfd];
+	readbufs[readfd].buf = NULL;
+	readbuf.refill = keep;
+	return;
+    }
+    if (readfd < 0 || fstat(readfd, &st))
+	return;
+    readbuf.seek = S_ISREG(st.st_mode) &&
+	lseek(readfd, 0, SEEK_CUR) != (off_t)-1;
+    if (!readbuf.seek && !keep)
+	return;
+    readbuf.buf = (char *)zalloc(READBUFSIZE);
+    readbuf.size = READBUFSIZE;
+    readbuf.len = readbuf.pos = 0;
+    readbuf.refill = 1;
+    readbuf.dev = st.st_dev;
+    readbuf.ino = st.st_ino;
+}
+
+/* Dispose of any data read from readfd but not used. */
+
+/**/
+static void
+zreadfinish(void)
+{
+    int left;
+
+    if (!readbuf.buf)
+	return;
+    left = readbuf.len - readbuf.pos;
+    if (left && readbuf.seek &&
+	lseek(readfd, -(off_t)left, SEEK_CUR) != (off_t)-1)
+	left = 0;
+    if (left && readfd >= 0) {
+	growreadbufs(readfd);
+	readbufs[readfd] = readbuf;
+    } else
+	zfree(readbuf.buf, readbuf.size);
+    readbuf.buf = NULL;
+}
+
+/**/
+static void
+growreadbufs(int fd)
+{
+    if (fd >= readbufsz) {
+	int newsz = fd + 1;
+
+	readbufs = (struct readbuf *)
+	    zrealloc(readbufs, newsz * sizeof(struct readbuf));
+	memset(readbufs + readbufsz, 0,
+	       (newsz - readbufsz) * sizeof(struct readbuf));
+	readbufsz = newsz;
+    }
+}
+
+/*
+ * The data kept for a file descriptor is shared with other builtins
+ * that read lines, such as mapfile.  zreadtake() copies up to size
+ * bytes of it to buf, returning how many; zreadkeep() adds len bytes
+ * read from fd but not used in front of anything still kept.
+ */
+
+/**/
+mod_export int
+zreadtake(int fd, char *buf, int size)
+{
+    struct readbuf *ra;
+    int len;
+
+    if (!zreadsaved(fd))
+	return 0;
+    ra = readbufs + fd;
+    if ((len = ra->len - ra->pos) > size)
+	len = size;
+    memcpy(buf, ra->buf + ra->pos, len);
+    if ((ra->pos += len) == ra->len) {
+	zfree(ra->buf, ra->size);
+	ra->buf = NULL;
+    }
+    return len;
+}
+
+/**/
+mod_export void
+zreadkeep(int fd, char *data, int len)
+{
+    struct readbuf *ra;
+    struct stat st;
+    int left, size;
+    char *buf;
+
+    if (fd < 0 || len <= 0)
+	return;
+    left = zreadsaved(fd) ? readbufs[fd].len - readbufs[fd].pos : 0;
+    if (!left && fstat(fd, &st))
+	return;
+    growreadbufs(fd);
+    ra = readbufs + fd;
+    size = (len + left > READBUFSIZE) ? len + left : READBUFSIZE;
+    buf = (char *)zalloc(size);
+    memcpy(buf, data, len);
+    if (left) {
+	memcpy(buf + len, ra->buf + ra->pos, left);
+	zfree(ra->buf, ra->size);
+    } else {
+	ra->dev = st.st_dev;
+	ra->ino = st.st_ino;
+    }
+    ra->buf = buf;
+    ra->size = size;
+    ra->len = len + left;
+    ra->pos = 0;
+    ra->seek = 0;
+    ra->refill = 0;
+}
+
 /* holds arguments for testlex() */
 /**/
 char **testargs, **curtestarg;
@@ -30,6 +30,10 @@
 #include "zsh.mdh"
 #include "exec.pro"
 
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MEMFD_CREATE)
+#include <sys/mman.h>
+#endif
+
 /* Flags for last argument of addvars */
 
 enum {
@@ -327,6 +331,7 @@ zfork(struct timeval *tv)
      * zippy anyway.
      */
     queue_signals();
+    fflush(stdout);
     pid = fork();
     unqueue_signals();
     if (pid == -1) {
@@ -657,6 +662,7 @@ execute(LinkList args, int flags, int defpath)
     char **argv, **pp, **newenvp = NULL;
     int eno = 0, ee;
 
+    fflush(stdout);
     arg0 = (char *) peekfirst(args);
     if (isset(RESTRICTED) && (strchr(arg0, '/') || defpath)) {
 	zerr("%s: restricted", arg0);
@@ -1272,7 +1278,7 @@ execsimple(Estate state)
 void
 execlist(Estate state, int dont_change_job, int exiting)
 {
-    static int donetrap;
+    static int donetrap, listdepth;
     Wordcode next;
     wordcode code;
     int ret, cj, csp, ltype;
@@ -1289,6 +1295,7 @@ execlist(Estate state, int dont_change_job, int exiting)
 
     queue_signals();
 
+    listdepth++;
     cj = thisjob;
     old_pline_level = pline_level;
     old_list_pipe = list_pipe;
@@ -1553,10 +1560,13 @@ sublist_done:
 		}
 	    }
 	}
+	/* Don't hold back output for long, including in loops */
+	releasestdout(listdepth == 1);
 	if (ltype & Z_END)
 	    break;
 	code = *state->pc++;
     }
+    listdepth--;
     pline_level = old_pline_level;
     list_pipe = old_list_pipe;
     list_pipe_job = old_list_pipe_job;
@@ -1690,8 +1700,10 @@ execpline(Estate state, wordcode slcode, int how, int last1)
 	    Job jn = jobtab + newjob;
 	    int updated;
 
-	    if (newjob == list_pipe_job && list_pipe_child)
+	    if (newjob == list_pipe_job && list_pipe_child) {
+		fflush(stdout);
 		_exit(0);
+	    }
 
 	    lastwj = thisjob = newjob;
 
@@ -2170,6 +2182,104 @@ clobber_open(struct redir *f)
 /* size of buffer for tee and cat processes */
 #define TCBUFSIZE 4092
 
+/**/
+#if defined(HAVE_TEE) && defined(HAVE_SPLICE) && defined(SPLICE_F_MOVE)
+
+/* largest amount to ask the kernel to copy at once */
+#define TCSPLICESIZE (1 << 20)
+
+/*
+ * Copy everything from fd in to fd out without passing it through
+ * user space, which requires at least one of them to be a pipe.
+ * Returns -1 if that's not possible for these file descriptors, in
+ * which case nothing has been consumed and the caller should copy
+ * it by hand.
+ */
+
+/**/
+static int
+catsplice(int in, int out)
+{
+    ssize_t len;
+    int moved = 0;
+
+    for (;;) {
+	len = splice(in, NULL, out, NULL, TCSPLICESIZE, SPLICE_F_MOVE);
+	if (len == 0)
+	    return 0;
+	if (len < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return moved ? 0 : -1;
+	}
+	moved = 1;
+    }
+}
+
+/*
+ * Copy everything from the pipe of a two-way output multio to both
+ * its targets without passing it through user space.  This needs one
+ * of the targets to be a pipe, which receives the data with tee();
+ * the same data is then moved to the other target with splice(), or,
+ * if that isn't allowed (as for files opened for appending), read and
+ * written by hand.  Returns -1 if nothing could be done, as above.
+ */
+
+/**/
+static int
+teesplice(struct multio *mn)
+{
+    char buf[TCBUFSIZE];
+    ssize_t len, slen;
+    struct stat st;
+    int teefd, splicefd, moved = 0, canspl = 1;
+
+    if (!fstat(mn->fds[0], &st) && S_ISFIFO(st.st_mode)) {
+	teefd = mn->fds[0];
+	splicefd = mn->fds[1];
+    } else if (!fstat(mn->fds[1], &st) && S_ISFIFO(st.st_mode)) {
+	teefd = mn->fds[1];
+	splicefd = mn->fds[0];
+    } else
+	return -1;
+
+    for (;;) {
+	len = tee(mn->pipe, teefd, TCSPLICESIZE, 0);
+	if (len == 0)
+	    return 0;
+	if (len < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return moved ? 0 : -1;
+	}
+	moved = 1;
+	/* Now consume exactly what went to teefd. */
+	while (len > 0) {
+	    if (canspl) {
+		slen = splice(mn->pipe, NULL, splicefd, NULL, len,
+			      SPLICE_F_MOVE);
+		if (slen < 0 && errno == EINTR)
+		    continue;
+		if (slen > 0) {
+		    len -= slen;
+		    continue;
+		}
+		canspl = 0;
+	    }
+	    slen = read(mn->pipe, buf, len < TCBUFSIZE ? len : TCBUFSIZE);
+	    if (slen < 0 && errno == EINTR)
+		continue;
+	    if (slen <= 0)
+		return 0;
+	    write_loop(splicefd, buf, slen);
+	    len -= slen;
+	}
+    }
+}
+
+/**/
+#endif
+
 /* close an multio (success) */
 
 /**/
@@ -2209,6 +2319,10 @@ closemn(struct multio **mfds, int fd, int type)
 	closeallelse(mn);
 	if (mn->rflag) {
 	    /* tee process */
+#if defined(HAVE_TEE) && defined(HAVE_SPLICE) && defined(SPLICE_F_MOVE)
+	    if (mn->ct == 2 && !teesplice(mn))
+		_exit(0);
+#endif
 	    while ((len = read(mn->pipe, buf, TCBUFSIZE)) != 0) {
 		if (len < 0) {
 		    if (errno == EINTR)
@@ -2221,7 +2335,11 @@ closemn(struct multio **mfds, int fd, int type)
 	    }
 	} else {
 	    /* cat process */
-	    for (i = 0; i < mn->ct; i++)
+	    for (i = 0; i < mn->ct; i++) {
+#if defined(HAVE_TEE) && defined(HAVE_SPLICE) && defined(SPLICE_F_MOVE)
+		if (!catsplice(mn->fds[i], mn->pipe))
+		    continue;
+#endif
 		while ((len = read(mn->fds[i], buf, TCBUFSIZE)) != 0) {
 		    if (len < 0) {
 			if (errno == EINTR)
@@ -2231,6 +2349,7 @@ closemn(struct multio **mfds, int fd, int type)
 		    }
 		    write_loop(mn->pipe, buf, len);
 		}
+	    }
 	}
 	_exit(0);
     } else if (fd >= 0 && type == REDIR_CLOSE)
@@ -2581,6 +2700,25 @@ execsubst(LinkList strs)
     }
 }
 
+/*
+ * As execsubst(), but if strs is just a numeric brace range leave it
+ * for the caller to generate the values from and return 1.
+ */
+
+/**/
+int
+execsubstrange(LinkList strs)
+{
+    int ret_flags = 0;
+
+    prefork(strs, esprefork | PREFORK_RANGE, &ret_flags);
+    if (ret_flags & PREFORK_RANGE)
+	return 1;
+    if (esglob && !errflag)
+	globlist(strs, 0);
+    return 0;
+}
+
 /*
  * Check if a builtin requires an autoload and if so
  * deal with it.  This may return NULL.
@@ -3585,6 +3723,9 @@ execcmd_exec(Estate state, Execcmd_params eparams,
 	}
     }
 
+    if (output || (redir && nonempty(redir)))
+	flushstdout();
+
     /* Add pipeline input/output to mnodes */
     if (input)
 	addfd(forked, save, mfds, 0, input, 0, NULL);
@@ -4097,6 +4238,14 @@ execcmd_exec(Estate state, Execcmd_params eparams,
 		    state->pc = opc;
 		}
 		dont_queue_signals();
+		/*
+		 * Only print and friends add to output held back;
+		 * anything else may block waiting for whoever reads it.
+		 */
+		if (((Builtin) hn)->handlerfunc != bin_print)
+		    flushstdout();
+		if (save[1] != -2)
+		    lazystdout = 0;	/* report errors on redirected output */
 		if (!errflag) {
 		    int ret = execbuiltin(args, assigns, (Builtin) hn);
 		    /*
@@ -4109,7 +4258,10 @@ execcmd_exec(Estate state, Execcmd_params eparams,
 		if (do_save & BINF_COMMAND)
 		    errflag &= ~ERRFLAG_ERROR;
 		restore_queue_signals(q);
-		fflush(stdout);
+		if (!stdoutlazy())
+		    fflush(stdout);
+		else if (!stdoutheld)
+		    stdoutheld = time(NULL);
 		if (save[1] == -2) {
 		    if (ferror(stdout)) {
 			zwarn("write error: %e", errno);
@@ -4134,6 +4286,7 @@ execcmd_exec(Estate state, Execcmd_params eparams,
 
 		/* If we are exec'ing a command, and we are not in a subshell, *
 		 * then check if we should save the history file.              */
+		flushhistsave();
 		if (isset(RCS) && interact && !nohistsave)
 		    savehistfile(NULL, 1, HFILE_USE_OPTIONS);
 		realexit();
@@ -4150,8 +4303,11 @@ execcmd_exec(Estate state, Execcmd_params eparams,
 
 		/* If we are exec'ing a command, and we are not *
 		 * in a subshell, then save the history file.   */
-		if (do_exec && isset(RCS) && interact && !nohistsave)
-		    savehistfile(NULL, 1, HFILE_USE_OPTIONS);
+		if (do_exec) {
+		    flushhistsave();
+		    if (isset(RCS) && interact && !nohistsave)
+			savehistfile(NULL, 1, HFILE_USE_OPTIONS);
+		}
 	    }
 	    if (type == WC_SIMPLE || type == WC_TYPESET) {
 		if (varspc) {
@@ -4159,8 +4315,10 @@ execcmd_exec(Estate state, Execcmd_params eparams,
 		    if (forked)
 			addflags |= ADDVAR_RESTORE;
 		    addvars(state, varspc, addflags);
-		    if (errflag)
+		    if (errflag) {
+			fflush(stdout);
 			_exit(1);
+		    }
 		}
 		closem(FDT_INTERNAL, 0);
 		if (coprocin != -1) {
@@ -4221,6 +4379,7 @@ execcmd_exec(Estate state, Execcmd_params eparams,
 	 * some architectural changes which are likely to be
 	 * hairy.
 	 */
+	fflush(stdout);
 	for (i = 0; i < 10; i++)
 	    if (fdtable[i] != FDT_UNUSED)
 		close(i);
@@ -4245,9 +4404,10 @@ execcmd_exec(Estate state, Execcmd_params eparams,
     fatal:
 	if (redir_err || errflag) {
 	    if (!isset(INTERACTIVE)) {
-		if (forked)
+		if (forked) {
+		    fflush(stdout);
 		    _exit(1);
-		else
+		} else
 		    exit(1);
 	    }
 	    errflag |= ERRFLAG_ERROR;
@@ -4534,8 +4694,34 @@ getherestr(struct redir *fn)
      */
     if (!(fn->flags & REDIRF_FROM_HEREDOC))
 	t[len++] = '\n';
-    if ((fd = gettempfile(NULL, 1, &s)) < 0)
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MEMFD_CREATE)
+    /*
+     * An anonymous file in memory needs no file system calls and,
+     * unlike a pipe, leaves the input seekable, as a command reading
+     * only part of it may rely on.
+     */
+    if ((fd = memfd_create("zsh-herestr", 0)) >= 0) {
+	if (write_loop(fd, t, len) == len && !lseek(fd, 0, SEEK_SET))
+	    return fd;
+	close(fd);
+    }
+#endif
+    if ((fd = gettempfile(NULL, 1, &s)) < 0) {
+#ifdef PIPE_BUF
+	/*
+	 * As a last resort, anything that fits in a pipe can be
+	 * written in one go without blocking.
+	 */
+	int pipes[2];
+
+	if (len <= PIPE_BUF && !pipe(pipes)) {
+	    write_loop(pipes[1], t, len);
+	    close(pipes[1]);
+	    return pipes[0];
+	}
+#endif
 	return -1;
+    }
     write_loop(fd, t, len);
     close(fd);
     fd = open(s, O_RDONLY | O_NOCTTY);
@@ -4644,6 +4830,7 @@ getoutput(char *cmd, int qt)
     cmdpush(CS_CMDSUBST);
     execode(prog, 0, 1, "cmdsubst");
     cmdpop();
+    fflush(stdout);
     close(1);
     _realexit();
     zerr("exit returned in child!!");
@@ -4666,12 +4853,21 @@ mod_export LinkList
 readoutput(int in, int qt, int *readerror)
 {
     LinkList ret;
-    char *buf, *bufptr, *ptr, inbuf[64];
-    int bsiz, c, cnt = 0, readret;
+    char *buf, *bufptr, *ptr, *endptr, *runptr, inbuf[BUFSIZ];
+    int bsiz = 64, cnt = 0, nmeta, readret;
     int q = queue_signal_level();
+    struct stat st;
 
     ret = newlinklist();
-    ptr = buf = (char *) hcalloc(bsiz = 64);
+    /*
+     * If we're reading straight from a file, as for $(<file),
+     * we know how much space we're likely to need.  Allow for
+     * a Nularg and the terminating null at the end.
+     */
+    if (!fstat(in, &st) && S_ISREG(st.st_mode) &&
+	st.st_size > bsiz && st.st_size < INT_MAX / 2)
+	bsiz = (int)st.st_size + 2;
+    ptr = buf = (char *) zhalloc(bsiz);
     /*
      * We need to be sensitive to SIGCHLD else we can be
      * stuck forever with important processes unreaped.
@@ -4682,31 +4878,44 @@ readoutput(int in, int qt, int *readerror)
     dont_queue_signals();
     child_unblock();
     for (;;) {
-	readret = read(in, inbuf, 64);
+	readret = read(in, inbuf, BUFSIZ);
 	if (readret <= 0) {
 	    if (readret < 0 && errno == EINTR)
 		continue;
 	    else
 		break;
 	}
-	for (bufptr = inbuf; bufptr < inbuf + readret; bufptr++) {
-	    c = *bufptr;
-	    if (imeta(c)) {
+	endptr = inbuf + readret;
+	for (nmeta = 0, bufptr = inbuf; bufptr < endptr; bufptr++)
+	    if (imeta(*bufptr))
+		nmeta++;
+	if (cnt + readret + nmeta + 2 > bsiz) {
+	    int nbsiz = bsiz * 2;
+
+	    while (cnt + readret + nmeta + 2 > nbsiz)
+		nbsiz *= 2;
+	    queue_signals();
+	    buf = (char *) hrealloc(buf, bsiz, nbsiz);
+	    dont_queue_signals();
+	    bsiz = nbsiz;
+	    ptr = buf + cnt;
+	}
+	/* Copy the input, metafying as we go, a run at a time. */
+	for (bufptr = inbuf; bufptr < endptr; ) {
+	    if (nmeta)
+		for (runptr = bufptr; runptr < endptr && !imeta(*runptr);
+		     runptr++)
+		    ;
+	    else
+		runptr = endptr;
+	    memcpy(ptr, bufptr, runptr - bufptr);
+	    ptr += runptr - bufptr;
+	    if ((bufptr = runptr) < endptr) {
 		*ptr++ = Meta;
-		c ^= 32;
-		cnt++;
-	    }
-	    if (++cnt >= bsiz) {
-		char *pp;
-		queue_signals();
-		pp = (char *) hcalloc(bsiz *= 2);
-		dont_queue_signals();
-
-		memcpy(pp, buf, cnt - 1);
-		ptr = (buf = pp) + cnt - 1;
+		*ptr++ = *bufptr++ ^ 32;
 	    }
-	    *ptr++ = c;
 	}
+	cnt = ptr - buf;
     }
     child_block();
     restore_queue_signals(q);
@@ -4851,6 +5060,7 @@ getoutputfile(char *cmd, char **eptr)
     cmdpush(CS_CMDSUBST);
     execode(prog, 0, 1, "equalsubst");
     cmdpop();
+    fflush(stdout);
     close(1);
     _realexit();
     zerr("exit returned in child!!");
@@ -4964,6 +5174,7 @@ getproc(char *cmd, char **eptr)
     cmdpush(CS_CMDSUBST);
     execode(prog, 0, 1, out ? "outsubst" : "insubst");
     cmdpop();
+    fflush(stdout);
     zclose(out);
     _realexit();
     return NULL;
@@ -45,6 +45,11 @@ struct gmatch {
     char *name;
     /* Unmetafied file name; embedded nulls can't occur in file names */
     char *uname;
+    /*
+     * If not NULL, a string that sorts with strcmp() the way uname
+     * sorts with zstrcmp(): see sortcollkey().
+     */
+    char *collkey;
     /*
      * Array of sort strings:  one for each GS_EXEC sort type in
      * the glob qualifiers.
@@ -173,9 +178,12 @@ struct globdata {
     int gd_matchct;		/* number of matches found              */
     int gd_pathbufsz;		/* size of pathbuf			*/
     int gd_pathbufcwd;		/* where did we chdir()'ed		*/
+    int gd_scandirfd;		/* fd of directory being read, or -1	*/
     Gmatch gd_matchbuf;		/* array of matches                     */
     Gmatch gd_matchptr;		/* &matchbuf[matchct]                   */
     char *gd_colonmod;		/* colon modifiers in qualifier list    */
+    LinkList gd_streamlist;	/* if set, insert() adds matches here   */
+    LinkNode gd_streamnode;	/* ... after this node                  */
 
     /* Qualifiers pertaining to current pattern */
     struct qual *gd_quals;
@@ -200,9 +208,12 @@ static struct globdata curglobdata;
 #define matchct       (curglobdata.gd_matchct)
 #define pathbufsz     (curglobdata.gd_pathbufsz)
 #define pathbufcwd    (curglobdata.gd_pathbufcwd)
+#define scandirfd     (curglobdata.gd_scandirfd)
 #define matchbuf      (curglobdata.gd_matchbuf)
 #define matchptr      (curglobdata.gd_matchptr)
 #define colonmod      (curglobdata.gd_colonmod)
+#define streamlist    (curglobdata.gd_streamlist)
+#define streamnode    (curglobdata.gd_streamnode)
 #define quals         (curglobdata.gd_quals)
 #define qualct        (curglobdata.gd_qualct)
 #define qualorct      (curglobdata.gd_qualorct)
@@ -285,6 +296,14 @@ statfullpath(const char *s, struct stat *st, int l)
     char buf[PATH_MAX+1];
     int check_for_being_a_directory = 0;
 
+#if defined(HAVE_FSTATAT) && defined(HAVE_DIRFD) && defined(AT_SYMLINK_NOFOLLOW)
+    /*
+     * While scanner() is reading a directory, s is an entry in it:
+     * stat relative to the directory instead of building the full path.
+     */
+    if (st && *s && scandirfd >= 0)
+	return fstatat(scandirfd, unmeta(s), st, l ? AT_SYMLINK_NOFOLLOW : 0);
+#endif
     DPUTS(strlen(s) + !*s + pathpos - pathbufcwd >= PATH_MAX,
 	  "BUG: statfullpath(): pathname too long");
     strcpy(buf, pathbuf + pathbufcwd);
@@ -339,11 +358,37 @@ statfullpath(const char *s, struct stat *st, int l)
 
 static char **inserts;
 
-/* add a match to the list */
+/*
+ * Return 1 if the qualifiers only look at the file type, so that the
+ * type from the directory entry will do instead of a stat.
+ */
+
+/**/
+static int
+qualsonlytype(void)
+{
+    struct qual *qo, *qn;
+
+    if (gf_listtypes || (gf_sorts & (GS_NORMAL|GS_LINKED)))
+	return 0;
+    for (qo = quals; qo; qo = qo->or)
+	for (qn = qo; qn && qn->func; qn = qn->next)
+	    if (qn->func != qualisreg && qn->func != qualisdir &&
+		qn->func != qualislnk && qn->func != qualisfifo &&
+		qn->func != qualissock && qn->func != qualisdev &&
+		qn->func != qualisblk && qn->func != qualischr)
+		return 0;
+    return 1;
+}
+
+/*
+ * Add a match to the list.  checked is set if we know the file exists;
+ * type is the file's S_IFMT bits if we already know them, else 0.
+ */
 
 /**/
 static void
-insert(char *s, int checked)
+insert(char *s, int checked, mode_t type)
 {
     struct stat buf, buf2, *bp;
     char *news = s;
@@ -352,14 +397,21 @@ insert(char *s, int checked)
     queue_signals();
     inserts = NULL;
 
+    if (type && !S_ISLNK(type) && (qualct || qualorct || gf_markdirs) &&
+	qualsonlytype()) {
+	/* Not a symlink, so following links makes no difference */
+	memset(&buf, 0, sizeof(buf));
+	buf.st_mode = type;
+	checked = statted = 1;
+    }
     if (gf_listtypes || gf_markdirs) {
 	/* Add the type marker to the end of the filename */
 	mode_t mode;
-	if (statfullpath(s, &buf, 1)) {
-	    unqueue_signals();
-	    return;
-	}
-	else {
+	if (!statted) {
+	    if (statfullpath(s, &buf, 1)) {
+		unqueue_signals();
+		return;
+	    }
 	    checked = statted = 1;
 	}
 	mode = buf.st_mode;
@@ -435,6 +487,14 @@ insert(char *s, int checked)
 	    statfullpath(s, &buf, 1);
 	    statted = 1;
 	}
+	if (streamlist) {
+	    /* Unsorted: no need to keep anything but the name */
+	    streamnode = insert_glob_match(streamlist, streamnode, news);
+	    matchct++;
+	    if (!inserts)
+		break;
+	    continue;
+	}
 	if (!(statted & 2) && (gf_sorts & GS_LINKED)) {
 	    if (statted) {
 		if (!S_ISLNK(buf.st_mode) || statfullpath(s, &buf2, 0))
@@ -491,6 +551,325 @@ insert(char *s, int checked)
     return;
 }
 
+/*
+ * Cache of directory contents used by scanner() when GLOB_CACHE is
+ * set, so that completion and repeated globs don't read the same
+ * directories again and again.  Entries are keyed on the device and
+ * inode of the directory and hold the names and, where readdir()
+ * supplied them, the types of its entries.  An entry is only used
+ * while the modification time of the directory is the one it had
+ * when it was read, and only if that time was already in the past
+ * then:  otherwise a change in the same clock tick would be missed.
+ */
+
+struct globdir {
+    struct hashnode node;
+    time_t mtime;		/* modification time of directory */
+    long mnsec;			/* nanoseconds of modification time */
+    int racy;			/* modified too recently to be reused */
+    int inuse;			/* being scanned, must not be freed */
+    int nents;			/* number of entries */
+    char **names;		/* names of entries, metafied */
+    mode_t *types;		/* types of entries, 0 if not known */
+};
+
+/* Don't cache more directories than this. */
+
+#define GLOBDIR_MAX 256
+
+static HashTable globdirtab;
+
+/* Number of cache entries currently being scanned */
+
+static int globdirsinuse;
+
+/**/
+static void
+freeglobdir(HashNode hn)
+{
+    Globdir gd = (Globdir)hn;
+    int i;
+
+    for (i = 0; i < gd->nents; i++)
+	zsfree(gd->names[i]);
+    if (gd->nents) {
+	zfree(gd->names, gd->nents * sizeof(char *));
+	zfree(gd->types, gd->nents * sizeof(mode_t));
+    }
+    zsfree(gd->node.nam);
+    zfree(gd, sizeof(struct globdir));
+}
+
+/* Throw away the cache if GLOB_CACHE has been turned off. */
+
+/**/
+static void
+checkglobdirs(void)
+{
+    if (globdirtab && unset(GLOBCACHE) && !globdirsinuse) {
+	deletehashtable(globdirtab);
+	globdirtab = NULL;
+    }
+}
+
+/*
+ * Return the cache entry for directory fn, reading the directory
+ * if it isn't in the cache or has changed.  Return NULL if the
+ * directory can't be cached; the caller should then read it itself.
+ * The entry is marked in use until released with doneglobdir().
+ */
+
+/**/
+static Globdir
+getglobdir(char *fn)
+{
+    struct stat st;
+    char key[2 * DIGBUFSIZE + 2], *name;
+    Globdir gd;
+    DIR *lock;
+    mode_t type;
+    int sz;
+    long mnsec = 0;
+
+    if (stat(fn, &st) || !S_ISDIR(st.st_mode))
+	return NULL;
+#ifdef GET_ST_MTIME_NSEC
+    mnsec = GET_ST_MTIME_NSEC(st);
+#endif
+    sprintf(key, "%lx:%lx", (unsigned long)st.st_dev,
+	    (unsigned long)st.st_ino);
+    if (!globdirtab) {
+	globdirtab = newhashtable(31, "globdirtab", NULL);
+
+	globdirtab->hash        = hasher;
+	globdirtab->emptytable  = emptyhashtable;
+	globdirtab->filltable   = NULL;
+	globdirtab->cmpnodes    = strcmp;
+	globdirtab->addnode     = addhashnode;
+	globdirtab->getnode     = gethashnode2;
+	globdirtab->getnode2    = gethashnode2;
+	globdirtab->removenode  = removehashnode;
+	globdirtab->disablenode = NULL;
+	globdirtab->enablenode  = NULL;
+	globdirtab->freenode    = freeglobdir;
+	globdirtab->printnode   = NULL;
+    } else if ((gd = (Globdir)gethashnode2(globdirtab, key))) {
+	if (!gd->racy && gd->mtime == st.st_mtime && gd->mnsec == mnsec) {
+	    gd->inuse++;
+	    globdirsinuse++;
+	    return gd;
+	}
+	/* Out of date; replace it unless someone is looking at it. */
+	if (gd->inuse)
+	    return NULL;
+	freeglobdir(removehashnode(globdirtab, key));
+    }
+    if (globdirtab->ct >= GLOBDIR_MAX) {
+	if (globdirsinuse)
+	    return NULL;
+	emptyhashtable(globdirtab);
+    }
+
+    if (!(lock = opendir(fn)))
+	return NULL;
+    gd = (Globdir)zshcalloc(sizeof(struct globdir));
+    gd->mtime = st.st_mtime;
+    gd->mnsec = mnsec;
+    gd->racy = st.st_mtime >= time(NULL);
+    for (sz = 0; (name = zreaddirtype(lock, 1, &type)) && !errflag; ) {
+	if (gd->nents == sz) {
+	    sz = sz ? 2 * sz : 32;
+	    gd->names = (char **)zrealloc(gd->names, sz * sizeof(char *));
+	    gd->types = (mode_t *)zrealloc(gd->types, sz * sizeof(mode_t));
+	}
+	gd->names[gd->nents] = ztrdup(name);
+	gd->types[gd->nents++] = type;
+    }
+    closedir(lock);
+    if (gd->nents < sz) {
+	gd->names = (char **)zrealloc(gd->names, gd->nents * sizeof(char *));
+	gd->types = (mode_t *)zrealloc(gd->types, gd->nents * sizeof(mode_t));
+    }
+    if (errflag) {
+	freeglobdir(&gd->node);
+	return NULL;
+    }
+    globdirtab->addnode(globdirtab, ztrdup(key), gd);
+    gd->inuse++;
+    globdirsinuse++;
+    return gd;
+}
+
+/**/
+static void
+doneglobdir(Globdir gd)
+{
+    gd->inuse--;
+    globdirsinuse--;
+}
+
+/*
+ * With GLOB_PREFETCH, a few child processes read the directories
+ * scanner() is about to descend into, and stat their entries, while
+ * scanner() is busy elsewhere.  On file systems with a high latency,
+ * such as NFS, the kernel then usually has the information by the
+ * time scanner() gets there.  The workers only warm the caches:
+ * scanner() still reads every directory itself, in the same order,
+ * so the matches and their order are the same with or without them.
+ *
+ * Each worker reads null-terminated directory names from a pipe.
+ * Writes to the pipes don't block; if a pipe is full, the name is
+ * dropped, since nothing depends on it being read ahead.
+ */
+
+#define GLOBPREFETCH_WORKERS 4
+
+#ifdef PIPE_BUF
+# define GLOBPREFETCH_NAMEMAX PIPE_BUF
+#else
+# define GLOBPREFETCH_NAMEMAX 512
+#endif
+
+static int prefetchfds[GLOBPREFETCH_WORKERS];
+static int nprefetchers, nextprefetcher;
+
+/* Read the directory name (unmetafied) and stat its entries. */
+
+/**/
+static void
+prefetchdir(char *name)
+{
+    DIR *d = opendir(*name ? name : ".");
+    struct dirent *de;
+#if defined(HAVE_FSTATAT) && defined(HAVE_DIRFD)
+    struct stat st;
+#endif
+
+    if (!d)
+	return;
+    while ((de = readdir(d))) {
+#if defined(HAVE_FSTATAT) && defined(HAVE_DIRFD)
+	(void)fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW);
+#endif
+    }
+    closedir(d);
+}
+
+/* The body of a worker:  read names from fd until the shell closes it. */
+
+/**/
+static void
+globprefetchwork(int fd)
+{
+    char buf[2 * GLOBPREFETCH_NAMEMAX], *ptr, *end;
+    int have = 0, len;
+
+    for (;;) {
+	if ((len = read(fd, buf + have, sizeof(buf) - have)) <= 0) {
+	    if (len < 0 && errno == EINTR)
+		continue;
+	    break;
+	}
+	have += len;
+	for (ptr = buf; (end = memchr(ptr, '\0', buf + have - ptr));
+	     ptr = end + 1)
+	    prefetchdir(ptr);
+	have -= ptr - buf;
+	memmove(buf, ptr, have);
+    }
+    _exit(0);
+}
+
+/*
+ * Start the workers.  Failing to start them isn't an error, the glob
+ * just goes without.  Returns the number running.
+ */
+
+/**/
+static int
+startglobprefetch(void)
+{
+    int pipes[2];
+    pid_t pid;
+
+    while (nprefetchers < GLOBPREFETCH_WORKERS) {
+	if (pipe(pipes) < 0)
+	    break;
+	queue_signals();
+	fflush(stdout);
+	if (!(pid = fork())) {
+	    int i;
+
+	    close(pipes[1]);
+	    for (i = 0; i < nprefetchers; i++)
+		close(prefetchfds[i]);
+	    signal_default(SIGINT);
+	    signal_default(SIGQUIT);
+	    signal_default(SIGTERM);
+	    signal_default(SIGHUP);
+	    globprefetchwork(pipes[0]);
+	}
+	unqueue_signals();
+	close(pipes[0]);
+	if (pid == -1) {
+	    close(pipes[1]);
+	    break;
+	}
+	if ((pipes[1] = movefd(pipes[1])) == -1)
+	    break;
+#ifdef O_NONBLOCK
+	fcntl(pipes[1], F_SETFL, fcntl(pipes[1], F_GETFL) | O_NONBLOCK);
+#endif
+	prefetchfds[nprefetchers++] = pipes[1];
+    }
+    return nprefetchers;
+}
+
+/* Close the pipes, so the workers exit when they have finished. */
+
+/**/
+static void
+stopglobprefetch(void)
+{
+    while (nprefetchers)
+	zclose(prefetchfds[--nprefetchers]);
+    nextprefetcher = 0;
+}
+
+/*
+ * Hand the subdirectories of the directory in pathbuf that scanner()
+ * is about to descend into to the workers, in the format of the
+ * subdirs list in scanner().
+ */
+
+/**/
+static void
+globprefetch(char *subdirs, int subdirlen)
+{
+    char buf[GLOBPREFETCH_NAMEMAX], *fn, *u;
+    int dirlen, l;
+
+    /* pathbuf is relative to a directory we have changed to */
+    if (pathbufcwd)
+	return;
+    if (!nprefetchers && !startglobprefetch())
+	return;
+    u = unmeta(pathbuf);
+    if ((dirlen = strlen(u)) >= GLOBPREFETCH_NAMEMAX)
+	return;
+    memcpy(buf, u, dirlen);
+    for (fn = subdirs; fn < subdirs + subdirlen;
+	 fn += strlen(fn) + 1 + sizeof(int)) {
+	u = unmeta(fn);
+	if (dirlen + (l = strlen(u)) >= GLOBPREFETCH_NAMEMAX)
+	    continue;
+	memcpy(buf + dirlen, u, l + 1);
+	if (write(prefetchfds[nextprefetcher], buf, dirlen + l + 1) < 0)
+	    continue;
+	nextprefetcher = (nextprefetcher + 1) % nprefetchers;
+    }
+}
+
 /* Do the globbing:  scanner is called recursively *
  * with successive bits of the path until we've    *
  * tried all of it.                                */
@@ -573,7 +952,7 @@ scanner(Complist q, int shortcircuit)
 	} else {
 	    if (str[l])
 		str = dupstrpfx(str, l);
-	    insert(str, 0);
+	    insert(str, 0, 0);
 	    if (shortcircuit && shortcircuit == matchct)
 		return;
 	}
@@ -581,13 +960,27 @@ scanner(Complist q, int shortcircuit)
 	/* Do pattern matching on current path section. */
 	char *fn = pathbuf[pathbufcwd] ? unmeta(pathbuf + pathbufcwd) : ".";
 	int dirs = !!q->next;
-	DIR *lock = opendir(fn);
+	DIR *lock = NULL;
+	Globdir gd = isset(GLOBCACHE) ? getglobdir(fn) : NULL;
 	char *subdirs = NULL;
-	int subdirlen = 0;
+	int subdirlen = 0, ent = 0;
+	mode_t type;
 
-	if (lock == NULL)
-	    return;
-	while ((fn = zreaddir(lock, 1)) && !errflag) {
+	if (!gd) {
+	    if ((lock = opendir(fn)) == NULL)
+		return;
+#if defined(HAVE_FSTATAT) && defined(HAVE_DIRFD)
+	    scandirfd = dirfd(lock);
+#endif
+	}
+	while (!errflag) {
+	    if (gd) {
+		if (ent == gd->nents)
+		    break;
+		type = gd->types[ent];
+		fn = gd->names[ent++];
+	    } else if (!(fn = zreaddirtype(lock, 1, &type)))
+		break;
 	    /* prefix and suffix are zle trickery */
 	    if (!dirs && !colonmod &&
 		((glob_pre && !strpfx(glob_pre, fn))
@@ -640,7 +1033,14 @@ scanner(Complist q, int shortcircuit)
 			errsfound = forceerrs + 1;
 			forceerrs = -1;
 		    }
-		    if (closure) {
+		    if (type && !S_ISLNK(type)) {
+			/*
+			 * The directory entry tells us if it's a directory;
+			 * if not, nothing further down the path can match.
+			 */
+			if (!S_ISDIR(type))
+			    continue;
+		    } else if (closure) {
 			/* if matching multiple directories */
 			struct stat buf;
 
@@ -665,18 +1065,28 @@ scanner(Complist q, int shortcircuit)
 		    subdirlen += sizeof(int);
 		} else {
 		    /* if the last filename component, just add it */
-		    insert(fn, 1);
+		    insert(fn, 1, type);
 		    if (shortcircuit && shortcircuit == matchct) {
-			closedir(lock);
+			scandirfd = -1;
+			if (gd)
+			    doneglobdir(gd);
+			else
+			    closedir(lock);
 			return;
 		    }
 		}
 	    }
 	}
-	closedir(lock);
+	scandirfd = -1;
+	if (gd)
+	    doneglobdir(gd);
+	else
+	    closedir(lock);
 	if (subdirs) {
 	    int oppos = pathpos;
 
+	    if (isset(GLOBPREFETCH))
+		globprefetch(subdirs, subdirlen);
 	    for (fn = subdirs; fn < subdirs+subdirlen; ) {
 		int l = strlen(fn);
 		addpath(fn, l);
@@ -943,8 +1353,11 @@ gmatchcmp(Gmatch a, Gmatch b)
     for (i = gf_nsorts, s = gf_sortlist; i; i--, s++) {
 	switch (s->tp & ~GS_DESC) {
 	case GS_NAME:
-	    r = zstrcmp(b->uname, a->uname,
-			gf_numsort ? SORTIT_NUMERICALLY : 0);
+	    if (a->collkey && b->collkey)
+		r = strcmp(b->collkey, a->collkey);
+	    else
+		r = zstrcmp(b->uname, a->uname,
+			    gf_numsort ? SORTIT_NUMERICALLY : 0);
 	    break;
 	case GS_DEPTH:
 	    {
@@ -1120,8 +1533,11 @@ glob_exec_string(char **sp)
 /*
  * Insert a glob match.
  * If there were words to prepend given by the P glob qualifier, do so.
+ * Returns the last node inserted.
  */
-static void
+
+/**/
+static LinkNode
 insert_glob_match(LinkList list, LinkNode next, char *data)
 {
     if (gf_pre_words) {
@@ -1139,6 +1555,7 @@ insert_glob_match(LinkList list, LinkNode next, char *data)
 	    next = insertlinknode(list, next, dupstring(getdata(added)));
 	}
     }
+    return next;
 }
 
 /*
@@ -1221,8 +1638,10 @@ zglob(LinkList list, LinkNode np, int nountok)
 					/* and index+1 of the last match */
     struct globdata saved;		/* saved glob state              */
     int nobareglob = !isset(BAREGLOBQUAL);
+    int prefetching;			/* GLOB_PREFETCH workers running */
     int shortcircuit = 0;		/* How many files to match;      */
 					/* 0 means no limit              */
+    int allkeys;			/* all matches have collation keys */
 
     if (unset(GLOBOPT) || !haswilds(ostr) || unset(EXECOPT)) {
 	if (!nountok)
@@ -1855,11 +2274,34 @@ zglob(LinkList list, LinkNode np, int nountok)
     matchptr = matchbuf = (Gmatch)zalloc((matchsz = 16) *
 					 sizeof(struct gmatch));
     matchct = 0;
+    scandirfd = -1;
+    checkglobdirs();
+    /*
+     * If the matches aren't to be sorted and we want all of them,
+     * put them straight into the list as they're found.
+     */
+    if ((gf_sortlist[0].tp & GS_NONE) && !first && end == -1) {
+	streamlist = list;
+	streamnode = node;
+    } else
+	streamlist = NULL;
     pattrystart();
 
     /* The actual processing takes place here: matches go into  *
      * matchbuf.  This is the only top-level call to scanner(). */
+    prefetching = nprefetchers;
     scanner(q, shortcircuit);
+    if (!prefetching)
+	stopglobprefetch();
+    if (streamlist) {
+	streamlist = NULL;
+	if (matchct) {
+	    badcshglob |= 2;
+	    zfree(matchbuf, 0);
+	    restore_globstate(saved);
+	    return;
+	}
+    }
 
     /* Deal with failures to match depending on options */
     if (matchct)
@@ -1955,12 +2397,52 @@ zglob(LinkList list, LinkNode np, int nountok)
 	    } else {
 		gmptr->uname = gmptr->name;
 	    }
+	    gmptr->collkey = NULL;
+	}
+	allkeys = 0;
+	/*
+	 * Transforming each name once for the locale is much cheaper
+	 * than doing it inside strcoll() for each of n log n comparisons.
+	 */
+	if (!gf_numsort && matchct > 1) {
+	    for (sortp = gf_sortlist; sortp < lastsortp; sortp++)
+		if ((sortp->tp & ~GS_DESC) == GS_NAME)
+		    break;
+	    if (sortp < lastsortp) {
+		int cmode = sortcollmode();
+
+		allkeys = 1;
+		for (gmptr = matchbuf; gmptr < matchptr; gmptr++)
+		    if (!(gmptr->collkey = sortcollkey(gmptr->uname, cmode)))
+			allkeys = 0;
+	    }
 	}
 
 	/* Sort arguments in to lexical (and possibly numeric) order. *
 	 * This is reversed to facilitate insertion into the list.    */
-	qsort((void *) & matchbuf[0], matchct, sizeof(struct gmatch),
-	      (int (*) _((const void *, const void *)))gmatchcmp);
+	if (gf_nsorts == 1 && matchct > 1 && allkeys) {
+	    /*
+	     * Just the name to sort on, and we have keys: sort
+	     * pointers to the keys, without going through gmatchcmp().
+	     */
+	    Gmatch *ptrs = (Gmatch *)zalloc(matchct * sizeof(Gmatch));
+	    Gmatch sorted = (Gmatch)zalloc(matchsz * sizeof(struct gmatch));
+	    Gmatch *pp;
+
+	    for (pp = ptrs, gmptr = matchbuf; gmptr < matchptr; gmptr++)
+		*pp++ = gmptr;
+	    qsort(ptrs, matchct, sizeof(Gmatch),
+		  (gf_sortlist[0].tp & GS_DESC) ? gmatchkeycmpdesc :
+		  gmatchkeycmp);
+	    for (pp = ptrs, gmptr = sorted; gmptr < sorted + matchct; gmptr++)
+		memcpy(gmptr, *pp++, sizeof(struct gmatch));
+	    zfree(ptrs, matchct * sizeof(Gmatch));
+	    zfree(matchbuf, 0);
+	    matchbuf = sorted;
+	    matchptr = matchbuf + matchct;
+	} else
+	    qsort((void *) & matchbuf[0], matchct, sizeof(struct gmatch),
+		  (int (*) _((const void *, const void *)))gmatchcmp);
     }
 
     if (first < 0) {
@@ -1997,6 +2479,22 @@ zglob(LinkList list, LinkNode np, int nountok)
     restore_globstate(saved);
 }
 
+/* Compare the collation keys of two pointers to matches, reversed */
+
+/**/
+static int
+gmatchkeycmp(const void *a, const void *b)
+{
+    return strcmp((*(Gmatch *)b)->collkey, (*(Gmatch *)a)->collkey);
+}
+
+/**/
+static int
+gmatchkeycmpdesc(const void *a, const void *b)
+{
+    return strcmp((*(Gmatch *)a)->collkey, (*(Gmatch *)b)->collkey);
+}
+
 /* Return the trailing character for marking file types */
 
 /**/
@@ -2252,6 +2750,154 @@ bracechardots(char *str, convchar_t *c1p, convchar_t *c2p)
     return 1;
 }
 
+/*
+ * Parse a numeric brace range {num1..num2} or {num1..num2..incr}.
+ * str points to the opening Inbrace and str2 to the closing Outbrace;
+ * dotdot is the number of ".." found between them.
+ *
+ * On success return 1 and set *startp to the first value to be
+ * generated, *stepp to the (possibly negative) difference between
+ * successive values, *countp to the number of values and *minwp to
+ * the width to which they are padded with zeroes.
+ */
+
+/**/
+static int
+bracerange(char *str, char *str2, int dotdot, zlong *startp, zlong *stepp,
+	   zulong *countp, int *minwp)
+{
+    char *dots, *p, *dots2 = NULL;
+    zlong rstart, rend, rincr = 1;
+    int rev = 0, wid1, wid2, wid3;
+    zulong rcount;
+
+    /* Get the first number of the range */
+    rstart = zstrtol(str+1,&dots,10);
+    wid1 = (dots - str) - 1;
+    wid2 = (str2 - dots) - 2;
+    wid3 = 0;
+
+    if (dots == str + 1 || *dots != '.' || dots[1] != '.')
+	return 0;
+    /* Get the last number of the range */
+    rend = zstrtol(dots+2,&p,10);
+    if (p == dots+2)
+	return 0;
+    /* check for {num1..num2..incr} */
+    if (p != str2) {
+	wid2 = (p - dots) - 2;
+	dots2 = p;
+	if (dotdot == 2 && *p == '.' && p[1] == '.') {
+	    rincr = zstrtol(p+2, &p, 10);
+	    wid3 = p - dots2 - 2;
+	    if (p != str2 || !rincr)
+		return 0;
+	} else
+	    return 0;
+    }
+    /* If either no. begins with a zero, pad the output with   *
+     * zeroes. Otherwise, set min width to 0 to suppress them.
+     * str+1 is the first number in the range, dots+2 the last,
+     * and dots2+2 is the increment if that's given. */
+    /* TODO: sorry about this */
+    *minwp = (str[1] == '0' ||
+	      (IS_DASH(str[1]) && str[2] == '0'))
+	     ? wid1
+	     : (dots[2] == '0' ||
+		(IS_DASH(dots[2]) && dots[3] == '0'))
+	     ? wid2
+	     : (dots2 && (dots2[2] == '0' ||
+			  (IS_DASH(dots2[2]) && dots2[3] == '0')))
+	     ? wid3
+	     : 0;
+    if (rincr < 0) {
+	/* Handle negative increment */
+	rincr = -rincr;
+	rev = !rev;
+    }
+    if (rstart > rend) {
+	/* Handle decreasing ranges correctly. */
+	zlong rt = rend;
+	rend = rstart;
+	rstart = rt;
+	rev = !rev;
+    } else if (rincr > 1) {
+	/* when incr > 1, range is aligned to the highest number of str1,
+	 * compensate for this so that it is aligned to the first number */
+	rend -= (rend - rstart) % rincr;
+    }
+    /*
+     * The values are rend, rend - rincr, ... down to rstart; rev
+     * says whether they come out in that order or the opposite one.
+     */
+    rcount = ((zulong)rend - (zulong)rstart) / (zulong)rincr;
+    if (rcount + 1 == 0) {
+	/* every possible value: the count doesn't fit */
+	zerr("brace expansion too large");
+	return 0;
+    }
+    if (rev) {
+	*startp = rend;
+	*stepp = -rincr;
+    } else {
+	*startp = rend - (zlong)(rcount * rincr);
+	*stepp = rincr;
+    }
+    *countp = rcount + 1;
+    return 1;
+}
+
+/*
+ * Write an element of a numeric brace range to buf, which must have
+ * room for DIGBUFSIZE + minw characters.  Return its length.
+ */
+
+/**/
+mod_export int
+bracerangeelt(char *buf, zlong val, int minw)
+{
+#if defined(ZLONG_IS_LONG_LONG) && defined(PRINTF_HAS_LLD)
+    return sprintf(buf, "%0*lld", minw, val);
+#else
+    return sprintf(buf, "%0*ld", minw, (long)val);
+#endif
+}
+
+/*
+ * Check if str is nothing but a numeric brace range, setting the
+ * values as bracerange() does if so.  This lets a caller that only
+ * steps through the values avoid expanding the range into a list.
+ */
+
+/**/
+mod_export int
+wordbracerange(char *str, zlong *startp, zlong *stepp, zulong *countp,
+	       int *minwp)
+{
+    char *str2;
+    int bc = 0, dotdot = 0;
+
+    if (*str != Inbrace || bracechardots(str, NULL, NULL))
+	return 0;
+    for (str2 = str; *str2; ++str2)
+	if (*str2 == Inbrace)
+	    ++bc;
+	else if (*str2 == Outbrace) {
+	    if (--bc == 0)
+		break;
+	} else if (bc == 1) {
+	    if (*str2 == Comma)
+		return 0;
+	    else if (*str2 == '.' && str2[1] == '.') {
+		dotdot++;
+		++str2;
+	    }
+	}
+    if (!*str2 || str2[1] || !dotdot)
+	return 0;
+    return bracerange(str, str2, dotdot, startp, stepp, countp, minwp);
+}
+
 /* brace expansion */
 
 /**/
@@ -2282,12 +2928,11 @@ xpandbraces(LinkList list, LinkNode *np)
     if (!comma && dotdot) {
 	/* Expand range like 0..10 numerically: comma or recursive
 	   brace expansion take precedence. */
-	char *dots, *p, *dots2 = NULL;
+	char *p;
 	LinkNode olast = last;
-	/* Get the first number of the range */
-	zlong rstart, rend;
-	int err = 0, rev = 0, rincr = 1;
-	int wid1, wid2, wid3, strp;
+	zlong rval, rstep;
+	zulong rcount;
+	int rev = 0, strp, minw;
 	convchar_t cstart, cend;
 
 	if (bracechardots(str, &cstart, &cend)) {
@@ -2329,83 +2974,44 @@ xpandbraces(LinkList list, LinkNode *np)
 	    return;
 	}
 
-	/* Get the first number of the range */
-	rstart = zstrtol(str+1,&dots,10);
-	rend = 0;
-	wid1 = (dots - str) - 1;
-	wid2 = (str2 - dots) - 2;
-	wid3 = 0;
-	strp = str - str3;
+	if (bracerange(str, str2, dotdot, &rval, &rstep, &rcount, &minw)) {
+	    /*
+	     * Put the strings in one block and the nodes in another
+	     * rather than allocating each separately: ranges can be
+	     * large.  Each string is at most as long as the wider of
+	     * the two ends of the range.
+	     */
+	    char *nbuf = zhalloc(DIGBUFSIZE + minw), *sufx = str2 + 1;
+	    int sufl = strlen(sufx), eltl, l;
+	    zulong i;
+	    LinkNode nodes;
 
-	if (dots == str + 1 || *dots != '.' || dots[1] != '.')
-	    err++;
-	else {
-	    /* Get the last number of the range */
-	    rend = zstrtol(dots+2,&p,10);
-	    if (p == dots+2)
-		err++;
-	    /* check for {num1..num2..incr} */
-	    if (p != str2) {
-		wid2 = (p - dots) - 2;
-		dots2 = p;
-		if (dotdot == 2 && *p == '.' && p[1] == '.') {
-		    rincr = zstrtol(p+2, &p, 10);
-		    wid3 = p - dots2 - 2;
-		    if (p != str2 || !rincr)
-			err++;
-		} else
-		    err++;
-	    }
-	}
-	if (!err) {
-	    /* If either no. begins with a zero, pad the output with   *
-	     * zeroes. Otherwise, set min width to 0 to suppress them.
-	     * str+1 is the first number in the range, dots+2 the last,
-	     * and dots2+2 is the increment if that's given. */
-	    /* TODO: sorry about this */
-	    int minw = (str[1] == '0' ||
-			(IS_DASH(str[1]) && str[2] == '0'))
-		       ? wid1
-		       : (dots[2] == '0' ||
-			  (IS_DASH(dots[2]) && dots[3] == '0'))
-		       ? wid2
-		       : (dots2 && (dots2[2] == '0' ||
-				    (IS_DASH(dots2[2]) && dots2[3] == '0')))
-		       ? wid3
-		       : 0;
-	    if (rincr < 0) {
-		/* Handle negative increment */
-		rincr = -rincr;
-		rev = !rev;
-	    }
-	    if (rstart > rend) {
-		/* Handle decreasing ranges correctly. */
-		zlong rt = rend;
-		rend = rstart;
-		rstart = rt;
-		rev = !rev;
-	    } else if (rincr > 1) {
-		/* when incr > 1, range is aligned to the highest number of str1,
-		 * compensate for this so that it is aligned to the first number */
-		rend -= (rend - rstart) % rincr;
+	    strp = str - str3;
+	    eltl = bracerangeelt(nbuf, rval, minw);
+	    l = bracerangeelt(nbuf, rval + (zlong)(rcount - 1) * rstep, minw);
+	    if (l > eltl)
+		eltl = l;
+	    eltl += strp + sufl + 1;
+	    if (rcount > ((size_t)-1 / 2) / eltl ||
+		rcount > ((size_t)-1 / 2) / sizeof(struct linknode)) {
+		zerr("brace expansion too large");
+		return;
 	    }
+	    p = (char *)zhalloc(rcount * eltl);
 	    uremnode(list, node);
-	    for (; rend >= rstart; rend -= rincr) {
-		/* Node added in at end, so do highest first */
-		p = dupstring(str3);
-#if defined(ZLONG_IS_LONG_LONG) && defined(PRINTF_HAS_LLD)
-		sprintf(p + strp, "%0*lld", minw, rend);
-#else
-		sprintf(p + strp, "%0*ld", minw, (long)rend);
-#endif
-		strcat(p + strp, str2 + 1);
-		insertlinknode(list, last, p);
-		if (rev)	/* decreasing:  add in reverse order. */
-		    last = nextnode(last);
+	    nodes = node = insertlinknodes(list, last, rcount);
+	    for (i = 0; i < rcount; i++, rval += rstep, incnode(node)) {
+		memcpy(p, str3, strp);
+		l = strp + bracerangeelt(p + strp, rval, minw);
+		memcpy(p + l, sufx, sufl + 1);
+		setdata(node, p);
+		p += l + sufl + 1;
 	    }
-	    *np = nextnode(olast);
+	    *np = nodes;
 	    return;
 	}
+	if (errflag)
+	    return;
     }
     if (!comma && isset(BRACECCL)) {	/* {a-mnop} */
 	/* Here we expand each character to a separate node,      *
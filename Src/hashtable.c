@@ -1420,10 +1420,12 @@ addhistnode(HashTable ht, char *nam, void *nodeptr)
 	 || (he->node.flags & HIST_FOREIGN && (Histent)oldnode == he->up)) {
 	    (void) addhashnode2(ht, oldnode->nam, oldnode); /* restore hash */
 	    he->node.flags |= HIST_DUP;
+	    histdupct++;
 	    he->node.flags &= ~HIST_MAKEUNIQUE;
 	}
 	else {
 	    oldnode->flags |= HIST_DUP;
+	    histdupct++;
 	    if (hist_ignore_all_dups)
 		freehistnode(oldnode); /* Remove the old dup */
 	}
@@ -1452,8 +1454,17 @@ freehistdata(Histent he, int unlink)
 
     if (!(he->node.flags & (HIST_DUP | HIST_TMPSTORE)))
 	removehashnode(histtab, he->node.nam);
+    else if (he->node.flags & HIST_DUP) {
+	/* keep histdupct right if the entry is recycled */
+	he->node.flags &= ~HIST_DUP;
+	histdupct--;
+    }
 
-    zsfree(he->node.nam);
+    if (he->node.flags & HIST_INCHUNK) {
+	histchunkfree(he->node.nam);
+	he->node.flags &= ~HIST_INCHUNK;
+    } else
+	zsfree(he->node.nam);
     if (he->nwords)
 	zfree(he->words, he->nwords*2*sizeof(short));
 
@@ -95,6 +95,11 @@ struct histent curline;
 /**/
 zlong histlinect;
 
+/* number of entries in the ring flagged HIST_DUP */
+
+/**/
+zlong histdupct;
+
 /* The history lines are kept in a hash, and also doubly-linked in a ring */
 
 /**/
@@ -216,6 +221,7 @@ static struct histfile_stats {
     char *text;
     time_t stim, mtim;
     off_t fpos, fsiz;
+    ino_t ino;
     int interrupted;
     zlong next_write_ev;
 } lasthist;
@@ -227,6 +233,7 @@ static struct histsave {
     Histent hist_ring;
     zlong curhist;
     zlong histlinect;
+    zlong histdupct;
     zlong histsiz;
     zlong savehistsiz;
     int locallevel;
@@ -543,6 +550,7 @@ getsubsargs(UNUSED(char *subline), int *gbalp, int *cflagp)
 static int
 getargc(Histent ehist)
 {
+    histentwords(ehist);
     return ehist->nwords ? ehist->nwords-1 : 0;
 }
 
@@ -1089,6 +1097,55 @@ unlinkcurline(void)
     curhist--;
 }
 
+/*
+ * With HIST_DEFER_SAVE, incremental writes to the history file are
+ * left to a timed function that zle calls once the prompt has been
+ * printed and it is waiting for input.  Nothing but the flag needs
+ * to be queued:  every write appends the entries not yet marked
+ * HIST_OLD, so any save that happens first keeps them in order.
+ */
+
+static int histsavepending;
+
+/* Do any history write queued by queuehistsave() */
+
+/**/
+void
+flushhistsave(void)
+{
+    if (!histsavepending)
+	return;
+    histsavepending = 0;
+    deltimedfn(flushhistsave);
+    /* Leave subshells and pushed histories to the normal writes */
+    if (mypid != getpid() || histsave_stack_pos != 0)
+	return;
+    if (histjournalling())
+	writehistjournal(getsparam("HISTFILE"));
+    else
+	savehistfile(NULL, 0, HFILE_USE_OPTIONS | HFILE_FAST);
+}
+
+/*
+ * Queue an incremental write if we can; return 0 if the caller
+ * must write the history now.
+ */
+
+static int
+queuehistsave(void)
+{
+    if (!isset(HISTDEFERSAVE) || isset(SHAREHISTORY) ||
+	histsave_stack_pos != 0 ||
+	!(interact && isset(SHINSTDIN) && SHTTY != -1 && isset(USEZLE)) ||
+	zle_load_state != 1)
+	return 0;
+    if (!histsavepending) {
+	histsavepending = 1;
+	addtimedfn(flushhistsave, time(NULL));
+    }
+    return 1;
+}
+
 /* initialize the history mechanism */
 
 /**/
@@ -1174,9 +1231,13 @@ hbegin(int dohist)
      */
     if (isset(INCAPPENDHISTORYTIME) && !isset(SHAREHISTORY) &&
 	!isset(INCAPPENDHISTORY) &&
-	!(histactive & HA_NOINC) && !strin && histsave_stack_pos == 0) {
+	!(histactive & HA_NOINC) && !strin && histsave_stack_pos == 0 &&
+	!queuehistsave()) {
 	hf = getsparam("HISTFILE");
-	savehistfile(hf, 0, HFILE_USE_OPTIONS | HFILE_FAST);
+	if (isset(HISTJOURNAL))
+	    writehistjournal(hf);
+	else
+	    savehistfile(hf, 0, HFILE_USE_OPTIONS | HFILE_FAST);
     }
 }
 
@@ -1240,6 +1301,8 @@ void
 histremovedups(void)
 {
     Histent he, next;
+    if (!histdupct)
+	return;
     for (he = hist_ring; he; he = next) {
 	next = up_histent(he);
 	if (he->node.flags & HIST_DUP)
@@ -1338,7 +1401,9 @@ putoldhistentryontop(short keep_going)
 	next = he->down;
     else
 	return;
-    if (isset(HISTEXPIREDUPSFIRST) && !(he->node.flags & HIST_DUP)) {
+    /* With no duplicates in the ring there is nothing to look for. */
+    if (isset(HISTEXPIREDUPSFIRST) && histdupct
+     && !(he->node.flags & HIST_DUP)) {
 	static zlong max_unique_ct = 0;
 	if (!keep_going)
 	    max_unique_ct = savehistsiz;
@@ -1507,7 +1572,10 @@ hend(Eprog prog)
     }
     /* For history sharing, lock history file once for both read and write */
     hf = getsparam("HISTFILE");
-    if (isset(SHAREHISTORY) && !lockhistfile(hf, 0)) {
+    if (isset(SHAREHISTORY) && histjournalling()) {
+	readhistjournals(hf, 0);
+	curline.histnum = curhist+1;
+    } else if (isset(SHAREHISTORY) && !lockhistfile(hf, 0)) {
 	readhistfile(hf, 0, HFILE_USE_OPTIONS | HFILE_FAST);
 	curline.histnum = curhist+1;
     }
@@ -1614,9 +1682,13 @@ hend(Eprog prog)
     /*
      * For normal INCAPPENDHISTORY case and reasoning, see hbegin().
      */
-    if (isset(SHAREHISTORY) ? histfileIsLocked() :
-	(isset(INCAPPENDHISTORY) || (isset(INCAPPENDHISTORYTIME) &&
-				     histsave_stack_pos != 0)))
+    if (histjournalling()) {
+	if (isset(SHAREHISTORY) ||
+	    (isset(INCAPPENDHISTORY) && !queuehistsave()))
+	    writehistjournal(hf);
+    } else if (isset(SHAREHISTORY) ? histfileIsLocked() :
+	((isset(INCAPPENDHISTORY) && !queuehistsave()) ||
+	 (isset(INCAPPENDHISTORYTIME) && histsave_stack_pos != 0)))
 	savehistfile(hf, 0, HFILE_USE_OPTIONS | HFILE_FAST);
     unlockhistfile(hf); /* It's OK to call this even if we aren't locked */
     /*
@@ -1815,6 +1887,7 @@ hconsearch(char *str, int *marg)
 	    continue;
 	if ((s = strstr(he->node.nam, str))) {
 	    int pos = s - he->node.nam;
+	    histentwords(he);
 	    while (t1 < he->nwords && he->words[2*t1] <= pos)
 		t1++;
 	    *marg = t1 - 1;
@@ -2410,8 +2483,12 @@ gethist(int ev)
 static char *
 getargs(Histent elist, int arg1, int arg2)
 {
-    short *words = elist->words;
-    int pos1, pos2, nwords = elist->nwords;
+    short *words;
+    int pos1, pos2, nwords;
+
+    histentwords(elist);
+    words = elist->words;
+    nwords = elist->nwords;
 
     if (arg2 < arg1 || arg1 >= nwords || arg2 >= nwords) {
 	/* remember, argN is indexed from 0, nwords is total no. of words */
@@ -2588,21 +2665,89 @@ resizehistents(void)
     }
 }
 
+/*
+ * The text of entries read from a history file is packed into large
+ * chunks rather than allocated line by line, so reading a long file
+ * takes far fewer allocations and the lines lie together in memory.
+ * Each line is preceded by a pointer back to its chunk; the chunk
+ * counts the lines it holds and is freed when the last of them goes.
+ * Entries so stored are flagged HIST_INCHUNK.
+ */
+
+struct histchunk {
+    zlong refs;			/* lines stored, plus one while filling */
+    size_t used;		/* bytes used including this header */
+};
+
+#define HISTCHUNK_SIZE	65536
+#define HISTCHUNK_MAXLINE 1024	/* longer lines are allocated separately */
+#define HISTCHUNK_ALIGN(n) \
+    (((n) + sizeof(struct histchunk *) - 1) & ~(sizeof(struct histchunk *) - 1))
+
+/* The chunk being filled */
+
+static struct histchunk *histchunk;
+
+/* Copy s into a chunk, or return NULL if it is too long for one. */
+
+static char *
+histchunkdup(char *s)
+{
+    size_t len = strlen(s) + 1;
+    size_t need = HISTCHUNK_ALIGN(sizeof(struct histchunk *) + len);
+    char *ptr;
+
+    if (len > HISTCHUNK_MAXLINE)
+	return NULL;
+    if (!histchunk || histchunk->used + need > HISTCHUNK_SIZE) {
+	if (histchunk && !--histchunk->refs)
+	    zfree(histchunk, HISTCHUNK_SIZE);
+	histchunk = (struct histchunk *)zalloc(HISTCHUNK_SIZE);
+	histchunk->refs = 1;
+	histchunk->used = HISTCHUNK_ALIGN(sizeof(struct histchunk));
+    }
+    ptr = (char *)histchunk + histchunk->used;
+    *(struct histchunk **)ptr = histchunk;
+    ptr += sizeof(struct histchunk *);
+    memcpy(ptr, s, len);
+    histchunk->used += need;
+    histchunk->refs++;
+    return ptr;
+}
+
+/* Release a line returned by histchunkdup(). */
+
+/**/
+void
+histchunkfree(char *s)
+{
+    struct histchunk *chunk = ((struct histchunk **)s)[-1];
+
+    if (!--chunk->refs)
+	zfree(chunk, HISTCHUNK_SIZE);
+}
+
+/*
+ * Read a history entry into *bufp, which is reallocated if needed.
+ * *fposp is advanced by the number of bytes read from the file.
+ */
+
 static int
-readhistline(int start, char **bufp, int *bufsiz, FILE *in)
+readhistline(int start, char **bufp, int *bufsiz, FILE *in, off_t *fposp)
 {
     char *buf = *bufp;
     if (fgets(buf + start, *bufsiz - start, in)) {
 	int len = start + strlen(buf + start);
 	if (len == start)
 	    return -1;
+	*fposp += len - start;
 	if (buf[len - 1] != '\n') {
 	    if (!feof(in)) {
 		if (len < (*bufsiz) - 1)
 		    return -1;
 		*bufp = zrealloc(buf, 2 * (*bufsiz));
 		*bufsiz = 2 * (*bufsiz);
-		return readhistline(len, bufp, bufsiz, in);
+		return readhistline(len, bufp, bufsiz, in, fposp);
 	    }
 	}
 	else {
@@ -2610,7 +2755,7 @@ readhistline(int start, char **bufp, int *bufsiz, FILE *in)
 	    if (len > 1 && buf[len - 2] == '\\') {
 		buf[--len - 1] = '\n';
 		if (!feof(in))
-		    return readhistline(len, bufp, bufsiz, in);
+		    return readhistline(len, bufp, bufsiz, in, fposp);
 	    }
 	}
 	return len;
@@ -2618,6 +2763,176 @@ readhistline(int start, char **bufp, int *bufsiz, FILE *in)
     return 0;
 }
 
+/*
+ * Count the entries in a history file the way readhistline() would
+ * split them, leaving the file at the start.  Return -1 if the file
+ * looks odd enough that readhistline() might disagree.
+ */
+
+static zlong
+counthistentries(FILE *in)
+{
+    char buf[8192], *ptr, *end;
+    size_t got;
+    zlong ct = 0;
+    int last = '\n';
+
+    while ((got = fread(buf, 1, sizeof(buf), in)) > 0) {
+	if (memchr(buf, '\0', got)) {
+	    ct = -1;
+	    break;
+	}
+	end = buf + got;
+	for (ptr = buf; (ptr = memchr(ptr, '\n', end - ptr)); ptr++) {
+	    if ((ptr > buf ? ptr[-1] : last) != '\\')
+		ct++;
+	}
+	last = buf[got - 1];
+    }
+    /*
+     * A final line with no newline is an entry.  Note one ending in
+     * a backslash and a newline isn't, which is what we've counted.
+     */
+    if (ct >= 0 && last != '\n')
+	ct++;
+    if (ferror(in))
+	ct = -1;
+    clearerr(in);
+    fseek(in, 0, 0);
+    return ct;
+}
+
+/*
+ * Take apart a line read by readhistline(), metafying it further if
+ * it comes from an older shell; *remetap is set if the heap was used
+ * for that.  Return the text of the entry and set its timestamps.
+ */
+
+static char *
+parsehistline(char *buf, time_t *stimp, time_t *ftimp, int *remetap)
+{
+    char *pt;
+
+    /*
+     * Handle the special case that we're reading from an
+     * old shell with fewer meta characters, so we need to
+     * metafy some more.  (It's not clear why the history
+     * file is metafied at all; some would say this is plain
+     * stupid.  But we're stuck with it now without some
+     * hairy workarounds for compatibility).
+     *
+     * This is rare so doesn't need to be that efficient; just
+     * allocate space off the heap.
+     */
+    *remetap = 0;
+    for (pt = buf; *pt; pt++) {
+	if (*pt == Meta && pt[1])
+	    pt++;
+	else if (imeta(*pt)) {
+	    *remetap = 1;
+	    break;
+	}
+    }
+    if (*remetap) {
+	int len;
+
+	unmetafy(buf, &len);
+	pt = metafy(buf, len, META_USEHEAP);
+    } else {
+	pt = buf;
+    }
+
+    if (*pt == ':') {
+	pt++;
+	*stimp = zstrtol(pt, NULL, 0);
+	for (; *pt != ':' && *pt; pt++);
+	if (*pt) {
+	    pt++;
+	    *ftimp = zstrtol(pt, NULL, 0);
+	    for (; *pt != ';' && *pt; pt++);
+	    if (*pt)
+		pt++;
+	} else
+	    *ftimp = *stimp;
+    } else {
+	if (*pt == '\\' && pt[1] == ':')
+	    pt++;
+	*stimp = *ftimp = 0;
+    }
+    return pt;
+}
+
+#define HISTFIND_BLOCK 8192
+
+/*
+ * The entry we last read or wrote isn't where we left it, so the
+ * file has been rewritten, usually by another shell trimming it to
+ * $SAVEHIST lines.  A rewrite keeps the newest entries at the end,
+ * so look for ours by searching back from there, only checking
+ * lines that start the way it does.  If it's found, leave the file
+ * positioned at it, estimate the number of lines before it from the
+ * part we searched, and return 1.  Return 0 if the entry is gone:
+ * then the file really was truncated and must be read from the start.
+ */
+
+static int
+relocatehistfile(FILE *in, off_t fsiz, char **bufp, int *bufsiz,
+		 off_t *fposp)
+{
+    char *prefix, *blk, *ptr;
+    off_t lo, hi, start, pos, endpos;
+    size_t plen, got;
+    zlong linect = 0;
+    time_t stim, ftim;
+    int remeta;
+
+    if (lasthist.stim) {
+	prefix = (char *)zhalloc(DIGBUFSIZE + 4);
+	sprintf(prefix, ": %ld:", (long)lasthist.stim);
+    } else {
+	plen = strcspn(lasthist.text, "\n");
+	if (plen > 32)
+	    plen = 32;
+	prefix = ptr = (char *)zhalloc(plen + 2);
+	if (*lasthist.text == ':')
+	    *ptr++ = '\\';
+	memcpy(ptr, lasthist.text, plen);
+	ptr[plen] = '\0';
+    }
+    plen = strlen(prefix);
+    blk = (char *)zhalloc(HISTFIND_BLOCK + plen + 1);
+
+    for (hi = fsiz; hi > 0; hi = lo) {
+	lo = hi > HISTFIND_BLOCK ? hi - HISTFIND_BLOCK : 0;
+	/* One byte more to see if lo starts a line, plen for the prefix */
+	start = lo ? lo - 1 : 0;
+	if (fseek(in, start, 0) < 0 ||
+	    (got = fread(blk, 1, hi - start + plen, in)) < (size_t)(hi - start))
+	    break;
+	for (pos = hi - 1; pos >= lo; pos--) {
+	    ptr = blk + (pos - start);
+	    if (pos && ptr[-1] != '\n')
+		continue;
+	    linect++;
+	    if ((size_t)(pos - start) + plen > got || memcmp(ptr, prefix, plen))
+		continue;
+	    endpos = pos;
+	    if (fseek(in, pos, 0) < 0 ||
+		readhistline(0, bufp, bufsiz, in, &endpos) <= 0)
+		continue;
+	    ptr = parsehistline(*bufp, &stim, &ftim, &remeta);
+	    if (stim == lasthist.stim && !histstrcmp(ptr, lasthist.text)) {
+		fseek(in, pos, 0);
+		*fposp = pos;
+		histfile_linect = pos * linect / (fsiz - pos) + 1;
+		return 1;
+	    }
+	}
+    }
+    clearerr(in);
+    return 0;
+}
+
 /**/
 void
 readhistfile(char *fn, int err, int readflags)
@@ -2626,11 +2941,12 @@ readhistfile(char *fn, int err, int readflags)
     FILE *in;
     Histent he;
     time_t stim, ftim, tim = time(NULL);
-    off_t fpos;
+    off_t fpos, nextfpos = 0;
     short *words;
     struct stat sb;
     int nwordpos, nwords, bufsiz;
-    int searching, newflags, l, ret, uselex;
+    int searching, relocated = 0, newflags, l, ret, uselex;
+    zlong skip = 0;
 
     if (!fn && !(fn = getsparam("HISTFILE")))
 	return;
@@ -2639,11 +2955,13 @@ readhistfile(char *fn, int err, int readflags)
 	return;
     if (readflags & HFILE_FAST) {
 	if (!lasthist.interrupted &&
-	    ((lasthist.fsiz == sb.st_size && lasthist.mtim == sb.st_mtime)
-	     || lockhistfile(fn, 0)))
+	    ((lasthist.fsiz == sb.st_size && lasthist.mtim == sb.st_mtime &&
+	      lasthist.ino == sb.st_ino)
+	     || (!(readflags & HFILE_NO_LOCK) && lockhistfile(fn, 0))))
 	    return;
 	lasthist.fsiz = sb.st_size;
 	lasthist.mtim = sb.st_mtime;
+	lasthist.ino = sb.st_ino;
 	lasthist.interrupted = 0;
     } else if ((ret = lockhistfile(fn, 1))) {
 	if (ret == 2) {
@@ -2663,81 +2981,69 @@ readhistfile(char *fn, int err, int readflags)
 	if (readflags & HFILE_FAST && lasthist.text) {
 	    if (lasthist.fpos < lasthist.fsiz) {
 		fseek(in, lasthist.fpos, 0);
+		nextfpos = lasthist.fpos;
+		searching = 1;
+	    } else if ((relocated = relocatehistfile(in, sb.st_size, &buf,
+						     &bufsiz, &nextfpos)))
 		searching = 1;
-	    }
 	    else {
+		fseek(in, 0, 0);
 		histfile_linect = 0;
 		searching = -1;
 	    }
 	} else
 	    searching = 0;
 
+	/*
+	 * When reading a whole file that has more entries than the
+	 * history can hold, only the last histsiz survive, so don't
+	 * bother making the others.  This doesn't apply if duplicates
+	 * are removed, since then more than histsiz entries may be
+	 * needed to fill the history.
+	 */
+	if (!(readflags & (HFILE_FAST|HFILE_SKIPOLD)) &&
+	    !hist_ignore_all_dups && unset(HISTEXPIREDUPSFIRST) &&
+	    sb.st_size > histsiz &&
+	    (skip = counthistentries(in) - histsiz) < 0)
+	    skip = 0;
+
 	newflags = HIST_OLD | HIST_READ;
 	if (readflags & HFILE_FAST)
 	    newflags |= HIST_FOREIGN;
 	if (readflags & HFILE_SKIPOLD
 	 || (hist_ignore_all_dups && newflags & hist_skip_flags))
 	    newflags |= HIST_MAKEUNIQUE;
-	while (fpos = ftell(in), (l = readhistline(0, &buf, &bufsiz, in))) {
+	while (fpos = nextfpos,
+	       (l = readhistline(0, &buf, &bufsiz, in, &nextfpos))) {
 	    char *pt;
-	    int remeta = 0;
+	    int remeta;
 
 	    if (l < 0) {
 		zerr("corrupt history file %s", fn);
 		break;
 	    }
-
-	    /*
-	     * Handle the special case that we're reading from an
-	     * old shell with fewer meta characters, so we need to
-	     * metafy some more.  (It's not clear why the history
-	     * file is metafied at all; some would say this is plain
-	     * stupid.  But we're stuck with it now without some
-	     * hairy workarounds for compatibility).
-	     *
-	     * This is rare so doesn't need to be that efficient; just
-	     * allocate space off the heap.
-	     */
-	    for (pt = buf; *pt; pt++) {
-		if (*pt == Meta && pt[1])
-		    pt++;
-		else if (imeta(*pt)) {
-		    remeta = 1;
-		    break;
-		}
-	    }
-	    if (remeta) {
-		unmetafy(buf, &remeta);
-		pt = metafy(buf, remeta, META_USEHEAP);
-	    } else {
-		pt = buf;
+	    if (skip) {
+		/* Numbered as if it had been read and then expired. */
+		skip--;
+		curhist++;
+		if (readflags & HFILE_USE_OPTIONS)
+		    histfile_linect++;
+		continue;
 	    }
 
-	    if (*pt == ':') {
-		pt++;
-		stim = zstrtol(pt, NULL, 0);
-		for (; *pt != ':' && *pt; pt++);
-		if (*pt) {
-		    pt++;
-		    ftim = zstrtol(pt, NULL, 0);
-		    for (; *pt != ';' && *pt; pt++);
-		    if (*pt)
-			pt++;
-		} else
-		    ftim = stim;
-	    } else {
-		if (*pt == '\\' && pt[1] == ':')
-		    pt++;
-		stim = ftim = 0;
-	    }
+	    pt = parsehistline(buf, &stim, &ftim, &remeta);
 
 	    if (searching) {
 		if (searching > 0) {
 		    if (stim == lasthist.stim
 		     && histstrcmp(pt, lasthist.text) == 0)
 			searching = 0;
-		    else {
+		    else if (relocated ||
+			     !(relocated = relocatehistfile(in, sb.st_size,
+							    &buf, &bufsiz,
+							    &nextfpos))) {
 			fseek(in, 0, 0);
+			nextfpos = 0;
 			histfile_linect = 0;
 			searching = -1;
 		    }
@@ -2757,8 +3063,11 @@ readhistfile(char *fn, int err, int readflags)
 	    }
 
 	    he = prepnexthistent();
-	    he->node.nam = ztrdup(pt);
 	    he->node.flags = newflags;
+	    if ((he->node.nam = histchunkdup(pt)))
+		he->node.flags |= HIST_INCHUNK;
+	    else
+		he->node.nam = ztrdup(pt);
 	    if ((he->stim = stim) == 0)
 		he->stim = he->ftim = tim;
 	    else if (ftim < stim)
@@ -2767,18 +3076,27 @@ readhistfile(char *fn, int err, int readflags)
 		he->ftim = ftim;
 
 	    /*
-	     * Divide up the words.
+	     * Divide up the words.  Unless we need the lexer, which
+	     * can't safely be used later from wherever the words are
+	     * wanted, leave that until they are:  most entries read
+	     * from a file never are.
 	     */
 	    start = pt;
 	    uselex = isset(HISTLEXWORDS) && !(readflags & HFILE_FAST);
-	    histsplitwords(pt, &words, &nwords, &nwordpos, uselex);
+	    if (uselex) {
+		histsplitwords(pt, &words, &nwords, &nwordpos, uselex);
 
-	    he->nwords = nwordpos/2;
-	    if (he->nwords) {
-		he->words = (short *)zalloc(nwordpos*sizeof(short));
-		memcpy(he->words, words, nwordpos*sizeof(short));
-	    } else
+		he->nwords = nwordpos/2;
+		if (he->nwords) {
+		    he->words = (short *)zalloc(nwordpos*sizeof(short));
+		    memcpy(he->words, words, nwordpos*sizeof(short));
+		} else
+		    he->words = (short *)NULL;
+	    } else {
+		he->node.flags |= HIST_NOWORDS;
+		he->nwords = 0;
 		he->words = (short *)NULL;
+	    }
 	    addhistnode(histtab, he->node.nam, he);
 	    if (he->node.flags & HIST_DUP) {
 		freehistnode(&he->node);
@@ -2808,7 +3126,8 @@ readhistfile(char *fn, int err, int readflags)
     } else if (err)
 	zerr("can't read history file %s", fn);
 
-    unlockhistfile(fn);
+    if (!(readflags & HFILE_NO_LOCK))
+	unlockhistfile(fn);
 
     if (zleactive)
 	zleentry(ZLE_CMD_SET_HIST_LINE, curhist);
@@ -2862,11 +3181,58 @@ flockhistfile(char *fn, int keep_trying)
 }
 #endif
 
+/* Compile $HISTORY_IGNORE on the heap, or return NULL if unset. */
+
+static Patprog
+histignorepat(void)
+{
+    char *history_ignore;
+
+    if ((history_ignore = getsparam("HISTORY_IGNORE")) == NULL)
+	return NULL;
+    tokenize(history_ignore = dupstring(history_ignore));
+    remnulargs(history_ignore);
+    return patcompile(history_ignore, 0, NULL);
+}
+
+/* Write a history entry as a line of a history file. */
+
+static int
+writehistent(FILE *out, Histent he, int extended_history)
+{
+    char *t = he->node.nam;
+    int count_backslashes = 0, ret = 0;
+
+    if (extended_history) {
+	ret = fprintf(out, ": %ld:%ld;", (long)he->stim,
+		      he->ftim? (long)(he->ftim - he->stim) : 0L);
+    } else if (*t == ':')
+	ret = fputc('\\', out);
+
+    for (; ret >= 0 && *t; t++) {
+	if (*t == '\n')
+	    if ((ret = fputc('\\', out)) < 0)
+		return ret;
+	if (*t == '\\')
+	    count_backslashes++;
+	else
+	    count_backslashes = 0;
+	if ((ret = fputc(*t, out)) < 0)
+	    return ret;
+    }
+    if (ret < 0)
+	return ret;
+    if (count_backslashes && (count_backslashes % 2 == 0))
+	if ((ret = fputc(' ', out)) < 0)
+	    return ret;
+    return fputc('\n', out);
+}
+
 /**/
 void
 savehistfile(char *fn, int err, int writeflags)
 {
-    char *t, *tmpfile, *start = NULL;
+    char *tmpfile, *start = NULL;
     FILE *out;
     Histent he;
     zlong xcurhist = curhist - !!(histactive & HA_ACTIVE);
@@ -2892,6 +3258,8 @@ savehistfile(char *fn, int err, int writeflags)
 	    zerr("locking failed for %s: %e", fn, errno);
 	    return;
 	}
+	if (writeflags & HFILE_USE_OPTIONS && histsave_stack_pos == 0)
+	    foldownhistjournal(fn);
 	he = hist_ring->down;
     }
     if (writeflags & HFILE_USE_OPTIONS) {
@@ -2960,21 +3328,13 @@ savehistfile(char *fn, int err, int writeflags)
 	}
     }
     if (out) {
-	char *history_ignore;
-	Patprog histpat = NULL;
+	Patprog histpat;
 
 	pushheap();
-
-	if ((history_ignore = getsparam("HISTORY_IGNORE")) != NULL) {
-	    tokenize(history_ignore = dupstring(history_ignore));
-	    remnulargs(history_ignore);
-	    histpat = patcompile(history_ignore, 0, NULL);
-	}
+	histpat = histignorepat();
 
 	ret = 0;
 	for (; he && he->histnum <= xcurhist; he = down_histent(he)) {
-	    int count_backslashes = 0;
-
 	    if ((writeflags & HFILE_SKIPDUPS && he->node.flags & HIST_DUP)
 	     || (writeflags & HFILE_SKIPFOREIGN && he->node.flags & HIST_FOREIGN)
 	     || he->node.flags & HIST_TMPSTORE)
@@ -2995,30 +3355,8 @@ savehistfile(char *fn, int err, int writeflags)
 		lasthist.stim = he->stim;
 		histfile_linect++;
 	    }
-	    t = start = he->node.nam;
-	    if (extended_history) {
-		ret = fprintf(out, ": %ld:%ld;", (long)he->stim,
-			      he->ftim? (long)(he->ftim - he->stim) : 0L);
-	    } else if (*t == ':')
-		ret = fputc('\\', out);
-
-	    for (; ret >= 0 && *t; t++) {
-		if (*t == '\n')
-		    if ((ret = fputc('\\', out)) < 0)
-			break;
-		if (*t == '\\')
-		    count_backslashes++;
-		else
-		    count_backslashes = 0;
-		if ((ret = fputc(*t, out)) < 0)
-		    break;
-	    }
-	    if (ret < 0)
-	    	break;
-	    if (count_backslashes && (count_backslashes % 2 == 0))
-		if ((ret = fputc(' ', out)) < 0)
-		    break;
-	    if (ret < 0 || (ret = fputc('\n', out)) < 0)
+	    start = he->node.nam;
+	    if ((ret = writehistent(out, he, extended_history)) < 0)
 		break;
 	}
 	if (ret >= 0 && start && writeflags & HFILE_USE_OPTIONS) {
@@ -3027,6 +3365,7 @@ savehistfile(char *fn, int err, int writeflags)
 		if (fstat(fileno(out), &sb) == 0) {
 		    lasthist.fsiz = sb.st_size;
 		    lasthist.mtim = sb.st_mtime;
+		    lasthist.ino = sb.st_ino;
 		}
 		zsfree(lasthist.text);
 		lasthist.text = ztrdup(start);
@@ -3299,6 +3638,308 @@ histfileIsLocked(void)
     return lockhistct > 0;
 }
 
+/*
+ * With HIST_JOURNAL, a shell that would add each command to $HISTFILE
+ * as it goes appends it instead to a journal of its own,
+ * $HISTFILE.journal.<host>.<pid>.  Nothing else writes the journal,
+ * so no lock is needed.  With SHARE_HISTORY, shells read the lines
+ * other shells have added to their journals since the last look.  A
+ * shell's journal is folded into $HISTFILE, under the usual lock, when
+ * the shell saves its history on exit; a shell starting up folds the
+ * journals left by shells on the same host that are no longer running.
+ */
+
+struct histjournal {
+    struct histjournal *next;
+    char *name;			/* path, metafied */
+    struct histfile_stats stats; /* how far we have read */
+    int seen;			/* found by the last directory scan */
+};
+
+/* Other shells' journals */
+
+static struct histjournal *histjournals;
+
+/* Directory and journal name prefix scanned for them, unmetafied */
+
+static char *histjournaldir, *histjournalpfx;
+
+/* Modification time of the directory, and time of the last scan */
+
+static time_t histjournalmtim, histjournalscan;
+
+/* This shell's journal, metafied, and the next event to write to it */
+
+static char *histjournal;
+static zlong histjournal_ev;
+
+/**/
+int
+histjournalling(void)
+{
+    return isset(HISTJOURNAL) && histsave_stack_pos == 0;
+}
+
+/* Append new history entries to this shell's journal. */
+
+/**/
+void
+writehistjournal(char *fn)
+{
+    Histent he;
+    zlong xcurhist = curhist - !!(histactive & HA_ACTIVE);
+    Patprog histpat;
+    FILE *out;
+    int fd;
+
+    if (!interact || savehistsiz <= 0 || !hist_ring
+     || (!fn && !(fn = getsparam("HISTFILE"))))
+	return;
+    he = gethistent(histjournal_ev, GETHIST_DOWNWARD);
+    while (he && he->node.flags & (HIST_OLD|HIST_NOWRITE|HIST_TMPSTORE)) {
+	histjournal_ev = he->histnum + 1;
+	he = down_histent(he);
+    }
+    if (!he || he->histnum > xcurhist)
+	return;
+    if (!histjournal) {
+	char *host = getsparam("HOST");
+
+	if (!host)
+	    host = "";
+	histjournal = zalloc(strlen(fn) + strlen(host) + DIGBUFSIZE + 11);
+	sprintf(histjournal, "%s.journal.%s.%ld", fn, host, (long)mypid);
+    }
+    fd = open(unmeta(histjournal), O_CREAT | O_WRONLY | O_APPEND | O_NOCTTY,
+	      0600);
+    if (fd < 0 || !(out = fdopen(fd, "a"))) {
+	if (fd >= 0)
+	    close(fd);
+	return;
+    }
+    pushheap();
+    histpat = histignorepat();
+    for (; he && he->histnum <= xcurhist; he = down_histent(he)) {
+	histjournal_ev = he->histnum + 1;
+	if (he->node.flags & (HIST_OLD|HIST_NOWRITE|HIST_TMPSTORE)
+	 || (histpat &&
+	     pattry(histpat, metafy(he->node.nam, -1, META_HEAPDUP))))
+	    continue;
+	if (writehistent(out, he, 1) < 0)
+	    break;
+    }
+    popheap();
+    fclose(out);
+}
+
+/*
+ * Append the journal to the history file fn, which the caller has
+ * locked, and remove it.  Return 0 if that worked.
+ */
+
+static int
+foldhistjournal(char *fn, char *journal)
+{
+    char buf[4096];
+    ssize_t len = 0;
+    int in, out;
+
+    if ((in = open(unmeta(journal), O_RDONLY | O_NOCTTY)) < 0)
+	return errno != ENOENT;
+    if ((out = open(unmeta(fn), O_CREAT | O_WRONLY | O_APPEND | O_NOCTTY,
+		    0600)) < 0) {
+	close(in);
+	return 1;
+    }
+    while ((len = read(in, buf, sizeof(buf))) > 0)
+	if (write_loop(out, buf, len) < 0) {
+	    len = -1;
+	    break;
+	}
+    close(in);
+    if (close(out) < 0 || len < 0)
+	return 1;
+    unlink(unmeta(journal));
+    return 0;
+}
+
+/*
+ * Fold this shell's journal into the history file fn, which the
+ * caller has locked.  The entries in it then count as written.
+ */
+
+/**/
+void
+foldownhistjournal(char *fn)
+{
+    Histent he;
+
+    if (!histjournal)
+	return;
+    writehistjournal(fn);
+    if (foldhistjournal(fn, histjournal))
+	return;
+    for (he = hist_ring; he && he->histnum >= histjournal_ev;
+	 he = up_histent(he))
+	;
+    for (; he; he = up_histent(he))
+	if (!(he->node.flags & HIST_FOREIGN))
+	    he->node.flags |= HIST_OLD;
+    zfree(histjournal, strlen(histjournal) + 1);
+    histjournal = NULL;
+}
+
+static void
+freehistjournal(struct histjournal *j)
+{
+    zsfree(j->name);
+    zsfree(j->stats.text);
+    zfree(j, sizeof(*j));
+}
+
+/* Bring the list of other shells' journals for fn up to date. */
+
+static void
+scanhistjournals(char *fn)
+{
+    struct histjournal *j, **jp;
+    struct stat sb;
+    char *dir, *pfx, *name, *ptr;
+    int pfxlen;
+    DIR *d;
+
+    fn = unmeta(fn);
+    if ((ptr = strrchr(fn, '/'))) {
+	dir = ptr == fn ? dupstring("/") : dupstrpfx(fn, ptr - fn);
+	ptr++;
+    } else {
+	dir = dupstring(".");
+	ptr = fn;
+    }
+    pfx = dyncat(ptr, ".journal.");
+    if (!histjournaldir || strcmp(dir, histjournaldir) ||
+	strcmp(pfx, histjournalpfx)) {
+	while ((j = histjournals)) {
+	    histjournals = j->next;
+	    freehistjournal(j);
+	}
+	zsfree(histjournaldir);
+	zsfree(histjournalpfx);
+	histjournaldir = ztrdup(dir);
+	histjournalpfx = ztrdup(pfx);
+	histjournalscan = 0;
+    }
+    /*
+     * Entries can't have changed if the directory hasn't since a scan
+     * made after the second it was last modified.
+     */
+    if (stat(dir, &sb) < 0 ||
+	(sb.st_mtime == histjournalmtim && histjournalscan > sb.st_mtime))
+	return;
+    if (!(d = opendir(dir)))
+	return;
+    histjournalmtim = sb.st_mtime;
+    histjournalscan = time(NULL);
+    for (j = histjournals; j; j = j->next)
+	j->seen = 0;
+    pfxlen = strlen(pfx);
+    while ((ptr = zreaddir(d, 1))) {
+	if (strncmp(ptr, pfx, pfxlen))
+	    continue;
+	name = metafy(zhtricat(dir, "/", ptr), -1, META_HEAPDUP);
+	if (histjournal && !strcmp(name, histjournal))
+	    continue;
+	for (j = histjournals; j; j = j->next)
+	    if (!strcmp(j->name, name))
+		break;
+	if (!j) {
+	    j = (struct histjournal *)zshcalloc(sizeof(*j));
+	    j->name = ztrdup(name);
+	    j->next = histjournals;
+	    histjournals = j;
+	}
+	j->seen = 1;
+    }
+    closedir(d);
+    for (jp = &histjournals; (j = *jp); ) {
+	if (j->seen)
+	    jp = &j->next;
+	else {
+	    *jp = j->next;
+	    freehistjournal(j);
+	}
+    }
+}
+
+/*
+ * Return 1 if the journal was left by a shell on this host that is no
+ * longer running.
+ */
+
+static int
+deadhistjournal(struct histjournal *j)
+{
+    char *host = getsparam("HOST"), *name, *ptr, *end;
+    size_t pfxlen = strlen(histjournaldir) + 1 + strlen(histjournalpfx);
+    long pid;
+
+    name = dupstring(unmeta(j->name)) + pfxlen;
+    host = host ? unmeta(host) : "";
+    if (!(ptr = strrchr(name, '.')))
+	return 0;
+    pid = strtol(ptr + 1, &end, 10);
+    if (*end || pid <= 0 || strlen(host) != (size_t)(ptr - name) ||
+	strncmp(name, host, ptr - name))
+	return 0;
+    return kill((pid_t)pid, 0) < 0 && errno == ESRCH;
+}
+
+/*
+ * Read whatever other shells have added to their journals since the
+ * last call.  If fold is set, also fold the journals of shells that
+ * have gone into the history file.
+ */
+
+/**/
+void
+readhistjournals(char *fn, int fold)
+{
+    struct histjournal *j, **jp;
+    struct histfile_stats stats = lasthist;
+    zlong linect = histfile_linect;
+
+    if (!fn && !(fn = getsparam("HISTFILE")))
+	return;
+    pushheap();
+    scanhistjournals(fn);
+    popheap();
+    for (j = histjournals; j; j = j->next) {
+	lasthist = j->stats;
+	readhistfile(j->name, 0,
+		     HFILE_USE_OPTIONS | HFILE_FAST | HFILE_NO_LOCK);
+	j->stats = lasthist;
+    }
+    lasthist = stats;
+    histfile_linect = linect;
+    if (!fold)
+	return;
+    pushheap();
+    for (jp = &histjournals; (j = *jp); ) {
+	if (deadhistjournal(j) && !lockhistfile(fn, 1)) {
+	    int ret = foldhistjournal(fn, j->name);
+
+	    unlockhistfile(fn);
+	    if (!ret) {
+		*jp = j->next;
+		freehistjournal(j);
+		continue;
+	    }
+	}
+	jp = &j->next;
+    }
+    popheap();
+}
+
 /*
  * Get the words in the current buffer. Using the lexer. 
  *
@@ -3569,6 +4210,30 @@ bufferwords(LinkList list, char *buf, int *index, int flags)
     return list;
 }
 
+/*
+ * Make sure the words of a history entry have been split up;
+ * see readhistfile().  Use this before looking at he->words.
+ */
+
+/**/
+mod_export void
+histentwords(Histent he)
+{
+    short *words;
+    int nwords = 64, nwordpos;
+
+    if (!(he->node.flags & HIST_NOWORDS))
+	return;
+    he->node.flags &= ~HIST_NOWORDS;
+    words = (short *)zalloc(nwords*sizeof(short));
+    histsplitwords(he->node.nam, &words, &nwords, &nwordpos, 0);
+    if ((he->nwords = nwordpos/2)) {
+	he->words = (short *)zalloc(nwordpos*sizeof(short));
+	memcpy(he->words, words, nwordpos*sizeof(short));
+    }
+    zfree(words, nwords*sizeof(short));
+}
+
 /*
  * Split up a line into words for use in a history file.
  *
@@ -3789,6 +4454,7 @@ pushhiststack(char *hf, zlong hs, zlong shs, int level)
     struct histsave *h;
     int curline_in_ring = (histactive & HA_ACTIVE) && hist_ring == &curline;
 
+    flushhistsave();
     if (histsave_stack_pos == histsave_stack_size) {
 	histsave_stack_size += 5;
 	histsave_stack = zrealloc(histsave_stack,
@@ -3812,6 +4478,7 @@ pushhiststack(char *hf, zlong hs, zlong shs, int level)
     h->hist_ring = hist_ring;
     h->curhist = curhist;
     h->histlinect = histlinect;
+    h->histdupct = histdupct;
     h->histsiz = histsiz;
     h->savehistsiz = savehistsiz;
     h->locallevel = level;
@@ -3824,7 +4491,7 @@ pushhiststack(char *hf, zlong hs, zlong shs, int level)
 	    unsetparam("HISTFILE");
     }
     hist_ring = NULL;
-    curhist = histlinect = 0;
+    curhist = histlinect = histdupct = 0;
     if (zleactive)
 	zleentry(ZLE_CMD_SET_HIST_LINE, curhist);
     histsiz = hs;
@@ -3869,6 +4536,7 @@ pophiststack(void)
     if (zleactive)
 	zleentry(ZLE_CMD_SET_HIST_LINE, curhist);
     histlinect = h->histlinect;
+    histdupct = h->histdupct;
     histsiz = h->histsiz;
     savehistsiz = h->savehistsiz;
 
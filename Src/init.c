@@ -1230,6 +1230,8 @@ setupshin(char *runscript)
      * Finish setting up SHIN and its relatives.
      */
     bshin = SHIN ? fdopen(SHIN, "r") : stdin;
+    if (SHIN)
+	shinbufalloc();
     if (isset(SHINSTDIN) && !SHIN && unset(INTERACTIVE)) {
 #ifdef _IONBF
 	setvbuf(stdin, NULL, _IONBF, 0);
@@ -1383,8 +1385,10 @@ init_misc(char *cmd, char *zsh_name)
 #endif
 	dosetopt(RESTRICTED, 1, 0, opts);
     if (cmd) {
-	if (SHIN >= 10)
+	if (SHIN >= 10) {
 	    fclose(bshin);
+	    shinbuffree();
+	}
 	SHIN = movefd(open("/dev/null", O_RDONLY | O_NOCTTY));
 	bshin = fdopen(SHIN, "r");
 	execstring(cmd, 0, 1, "cmdarg");
@@ -1392,8 +1396,11 @@ init_misc(char *cmd, char *zsh_name)
 	zexit((exit_pending || shell_exiting) ? exit_val : lastval, ZEXIT_NORMAL);
     }
 
-    if (interact && isset(RCS))
+    if (interact && isset(RCS)) {
 	readhistfile(NULL, 0, HFILE_USE_OPTIONS);
+	if (isset(HISTJOURNAL))
+	    readhistjournals(NULL, 1);
+    }
 }
 
 /*
@@ -1410,6 +1417,7 @@ source(char *s)
     zlong oldlineno;
     int oldshst, osubsh, oloops;
     FILE *obshin;
+    char *obshinbuf;
     char *old_scriptname = scriptname, *us;
     char *old_scriptfilename = scriptfilename;
     unsigned char *ocs;
@@ -1427,6 +1435,7 @@ source(char *s)
     /* save the current shell state */
     fd        = SHIN;            /* store the shell input fd                  */
     obshin    = bshin;          /* store file handle for buffered shell input */
+    obshinbuf = bshinbuf;       /* store the buffer that handle uses          */
     osubsh    = subsh;           /* store whether we are in a subshell        */
     cj        = thisjob;         /* store our current job number              */
     oldlineno = lineno;          /* store our current lineno                  */
@@ -1440,6 +1449,7 @@ source(char *s)
     if (!prog) {
 	SHIN = tempfd;
 	bshin = fdopen(SHIN, "r");
+	shinbufalloc();
     }
     subsh  = 0;
     lineno = 1;
@@ -1508,9 +1518,11 @@ source(char *s)
 	freeeprog(prog);
     else {
 	fclose(bshin);
+	shinbuffree();
 	fdtable[SHIN] = FDT_UNUSED;
 	SHIN = fd;		     /* the shell input fd                   */
 	bshin = obshin;		     /* file handle for buffered shell input */
+	bshinbuf = obshinbuf;	     /* and its buffer                       */
     }
     subsh = osubsh;                  /* whether we are in a subshell         */
     thisjob = cj;                    /* current job number                   */
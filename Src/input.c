@@ -85,6 +85,17 @@ int SHIN;
 /**/
 FILE *bshin;
 
+/*
+ * Buffer for bshin if it is reading a regular file, else NULL.
+ * See shinbufalloc().
+ */
+
+/**/
+char *bshinbuf;
+
+/* Size of bshinbuf: scripts are read this much at a time. */
+#define SHINBUFSIZE 65536
+
 /* != 0 means we are reading input from a string */
  
 /**/
@@ -129,6 +140,41 @@ static struct instacks *instack, *instacktop;
 
 static int instacksz = INSTACK_INITIAL;
 
+/*
+ * bshin has just been opened on SHIN.  If that's a regular file
+ * there's no reason not to read ahead, so give it a large buffer
+ * in order that scripts are read in big blocks; shingetline() can
+ * then also take whole lines at once.  The caller should save
+ * bshinbuf along with bshin if it needs to restore the old input.
+ */
+
+/**/
+void
+shinbufalloc(void)
+{
+    struct stat st;
+
+    bshinbuf = NULL;
+#ifdef _IOFBF
+    if (!fstat(fileno(bshin), &st) && S_ISREG(st.st_mode)) {
+	bshinbuf = (char *)zalloc(SHINBUFSIZE);
+	setvbuf(bshin, bshinbuf, _IOFBF, SHINBUFSIZE);
+    }
+#endif
+}
+
+/* Free the buffer from shinbufalloc() once bshin has been closed. */
+
+/**/
+void
+shinbuffree(void)
+{
+    if (bshinbuf) {
+	zfree(bshinbuf, SHINBUFSIZE);
+	bshinbuf = NULL;
+    }
+}
+
 /* Read a line from bshin.  Convert tokens and   *
  * null characters to Meta c^32 character pairs. */
 
@@ -143,6 +189,29 @@ shingetline(void)
     char *p;
     int q = queue_signal_level();
 
+#ifdef HAVE_GETDELIM
+    /*
+     * Reads from a regular file aren't interrupted by signals, so
+     * we can let stdio find the end of the line for us and then
+     * metafy it in one go.
+     */
+    if (bshinbuf) {
+	size_t sz = 0;
+	ssize_t len;
+
+	winch_unblock();
+	dont_queue_signals();
+	len = getdelim(&line, &sz, '\n', bshin);
+	winch_block();
+	restore_queue_signals(q);
+	if (len <= 0) {
+	    free(line);
+	    return NULL;
+	}
+	return metafy(line, len, META_REALLOC);
+    }
+#endif
+
     p = buf;
     winch_unblock();
     dont_queue_signals();
@@ -242,6 +311,8 @@ inputline(void)
     char *ingetcline, **ingetcpmptl = NULL, **ingetcpmptr = NULL;
     int context = ZLCON_LINE_START;
 
+    if (isset(SHINSTDIN))
+	fflush(stdout);
     /* If reading code interactively, work out the prompts. */
     if (interact && isset(SHINSTDIN)) {
 	if (!isfirstln) {
@@ -674,6 +745,36 @@ ingetptr(void)
     return inbufptr;
 }
 
+/*
+ * Consume a run of characters from the current input buffer for
+ * which runtab is non-zero, without going through ingetc() for each.
+ * Only the current stack element is examined; ingetc() takes care
+ * of moving on to the next.  The start of the run is returned in
+ * *startp and its length as the return value.
+ *
+ * This is for the lexer's benefit, so runtab must exclude
+ * tokens and newlines, for which ingetc() does extra work.
+ */
+
+/**/
+int
+ingetrun(unsigned char *runtab, char **startp)
+{
+    char *ptr = inbufptr, *end = inbufptr + inbufleft;
+    int len;
+
+    *startp = inbufptr;
+    if (lexstop)
+	return 0;
+    while (ptr < end && runtab[STOUC(*ptr)])
+	ptr++;
+    len = ptr - inbufptr;
+    inbufptr = ptr;
+    inbufleft -= len;
+    inbufct -= len;
+    return len;
+}
+
 /*
  * Check if the current input line, including continuations, is
  * expanding an alias.  This does not detect alias expansions that
@@ -1535,6 +1535,7 @@ waitforpid(pid_t pid, int wait_cmd)
 {
     int first = 1, q = queue_signal_level();
 
+    fflush(stdout);
     /* child_block() around this loop in case #ifndef WNOHANG */
     dont_queue_signals();
     child_block();		/* unblocked in signal_suspend() */
@@ -1582,6 +1583,7 @@ zwaitjob(int job, int wait_cmd)
     int q = queue_signal_level();
     Job jn = jobtab + job;
 
+    fflush(stdout);
     child_block();		 /* unblocked during signal_suspend() */
     queue_traps(wait_cmd);
     dont_queue_signals();
@@ -2588,6 +2590,9 @@ bin_kill(char *nam, char **argv, UNUSED(Options ops), UNUSED(int func))
     int sig = SIGTERM;
     int returnval = 0;
 
+    /* the process we signal may well write to the same place */
+    fflush(stdout);
+
     /* check for, and interpret, a signal specifier */
     if (*argv && **argv == '-') {
 	if (idigit((*argv)[1])) {
@@ -405,6 +405,12 @@ ctxtlex(void)
 
 static unsigned char lexact1[256], lexact2[256], lextok2[256];
 
+/*
+ * Characters that gettokstr() would simply append to the token
+ * unchanged, so that runs of them can be copied in one go.
+ */
+static unsigned char lexplain[256];
+
 /**/
 void
 initlextabs(void)
@@ -432,6 +438,9 @@ initlextabs(void)
     lextok2['~'] = Tilde;
     lextok2['#'] = Pound;
     lextok2['^'] = Hat;
+    for (t0 = 0; t0 != 256; t0++)
+	lexplain[t0] = (lexact2[t0] == LX2_OTHER && lextok2[t0] == t0 &&
+			!inblank(t0) && !imeta(t0));
 }
 
 /* initialize lexical state */
@@ -444,6 +453,49 @@ lexinit(void)
     tok = ENDINPUT;
 }
 
+/* add a string of len chars to the string buffer */
+
+/**/
+static void
+addrun(char *s, int len)
+{
+    if (lexbuf.len + len >= lexbuf.siz) {
+	int newbsiz = lexbuf.siz * 2;
+
+	while (lexbuf.len + len >= newbsiz)
+	    newbsiz *= 2;
+	tokstr = (char *)hrealloc(tokstr, lexbuf.siz, newbsiz);
+	lexbuf.ptr = tokstr + lexbuf.len;
+	memset(lexbuf.ptr, 0, newbsiz - lexbuf.len);
+	lexbuf.siz = newbsiz;
+    }
+    memcpy(lexbuf.ptr, s, len);
+    lexbuf.ptr += len;
+    lexbuf.len += len;
+}
+
+/*
+ * Add any run of plain characters waiting in the input buffer.
+ * This is only valid when there is no history processing to be
+ * done on the input, i.e. hgetc is plain ingetc.
+ */
+
+/**/
+static void
+addplainrun(void)
+{
+    char *s;
+    int len = ingetrun(lexplain, &s);
+
+    if (!len)
+	return;
+    addrun(s, len);
+    if (lex_add_raw) {
+	while (len--)
+	    zshlex_raw_add(*s++);
+    }
+}
+
 /* add a char to the string buffer */
 
 /**/
@@ -1383,6 +1435,12 @@ gettokstr(int c, int sub)
                c = '!';
        }
        add(c);
+       /*
+	* Without history or ZLE to keep informed, ordinary characters
+	* following this one can be taken straight from the input.
+	*/
+       if (act == LX2_OTHER && hgetc == ingetc && !(lexflags & LEXFLAGS_ZLE))
+	   addplainrun();
        c = hgetc();
 	if (intpos)
 	    intpos--;
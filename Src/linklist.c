@@ -146,6 +146,37 @@ insertlinknode(LinkList list, LinkNode node, void *dat)
     return new;
 }
 
+/*
+ * Insert count nodes after a given node, allocated in one block.
+ * Their data is left for the caller to fill in; return the first.
+ * The caller must make sure the size of the block doesn't overflow.
+ */
+
+/**/
+mod_export LinkNode
+insertlinknodes(LinkList list, LinkNode node, zulong count)
+{
+    LinkNode tmp, new;
+    zulong i;
+
+    if (!count)
+	return NULL;
+    tmp = node->next;
+    new = (LinkNode) zhalloc(count * sizeof *tmp);
+    for (i = 0; i < count; i++) {
+	new[i].prev = i ? new + i - 1 : node;
+	new[i].next = new + i + 1;
+	new[i].dat = NULL;
+    }
+    node->next = new;
+    new[count - 1].next = tmp;
+    if (tmp)
+	tmp->prev = new + count - 1;
+    else
+	list->list.last = new + count - 1;
+    return new;
+}
+
 /**/
 mod_export LinkNode
 zinsertlinknode(LinkList list, LinkNode node, void *dat)
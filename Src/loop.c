@@ -52,9 +52,10 @@ execfor(Estate state, int do_exec)
     Wordcode end, loop;
     wordcode code = state->pc[-1];
     int iscond = (WC_FOR_TYPE(code) == WC_FOR_COND), ctok = 0, atok = 0;
-    int last = 0;
-    char *name, *str, *cond = NULL, *advance = NULL;
-    zlong val = 0;
+    int last = 0, lazyrange = 0, rminw = 0;
+    char *name, *str, *cond = NULL, *advance = NULL, *rbuf = NULL;
+    zlong val = 0, rval = 0, rstep = 0;
+    zulong rcount = 0;
     LinkList vars = NULL, args = NULL;
     int old_simple_pline = simple_pline;
 
@@ -95,7 +96,15 @@ execfor(Estate state, int do_exec)
 		return 0;
 	    }
 	    if (htok) {
-		execsubst(args);
+		/*
+		 * A range such as {1..1000000} is stepped through
+		 * below rather than expanded into a list first.
+		 */
+		if (execsubstrange(args)) {
+		    lazyrange = wordbracerange(ugetnode(args), &rval,
+					       &rstep, &rcount, &rminw);
+		    rbuf = zhalloc(DIGBUFSIZE + rminw);
+		}
 		if (errflag) {
 		    state->pc = end;
 		    simple_pline = old_simple_pline;
@@ -111,7 +120,7 @@ execfor(Estate state, int do_exec)
 	}
     }
 
-    if (!args || empty(args))
+    if (!args || (empty(args) && !lazyrange))
 	lastval = 0;
 
     loops++;
@@ -152,7 +161,12 @@ execfor(Estate state, int do_exec)
 	    for (node = firstnode(vars); node; incnode(node))
 	    {
 		name = (char *)getdata(node);
-		if (!args || !(str = (char *) ugetnode(args)))
+		if (lazyrange && rcount) {
+		    bracerangeelt(rbuf, rval, rminw);
+		    str = rbuf;
+		    rval += rstep;
+		    rcount--;
+		} else if (!args || !(str = (char *) ugetnode(args)))
 		{
 		    if (count) { 
 			str = "";
@@ -172,7 +186,7 @@ execfor(Estate state, int do_exec)
 		break;
 	}
 	state->pc = loop;
-	execlist(state, 1, do_exec && args && empty(args));
+	execlist(state, 1, do_exec && args && empty(args) && !rcount);
 	if (breaks) {
 	    breaks--;
 	    if (breaks || !contflag)
@@ -131,7 +131,10 @@ eltpcmp(const void *a, const void *b)
     }
 
 #ifdef HAVE_STRCOLL
-    cmp = strcoll(as, bs);
+    if (ae->key && be->key)
+	cmp = strcmp(ae->key, be->key);
+    else
+	cmp = strcoll(as, bs);
 #endif
 
     if (sortnumeric) {
@@ -168,6 +171,19 @@ eltpcmp(const void *a, const void *b)
 }
 
 
+/*
+ * Compare elements that all have collation keys when not sorting
+ * numerically:  all the work was done when making the keys.
+ */
+
+/**/
+static int
+eltpkeycmp(const void *a, const void *b)
+{
+    return sortdir * strcmp((*(const SortElt *)a)->key,
+			    (*(const SortElt *)b)->key);
+}
+
 /*
  * Front-end to eltpcmp() to compare strings.
  * TODO: it would be better to eliminate this altogether by
@@ -189,6 +205,7 @@ zstrcmp(const char *as, const char *bs, int sortflags)
     be.cmp = bs;
     ae.len = -1;
     be.len = -1;
+    ae.key = be.key = NULL;
 
     aeptr = &ae;
     beptr = &be;
@@ -208,6 +225,61 @@ zstrcmp(const char *as, const char *bs, int sortflags)
 }
 
 
+/*
+ * Return 1 if strings compared with zstrcmp() are in the order given
+ * by strcmp() anyway, 2 if we need to transform them with strxfrm()
+ * first, or 0 if we can't make keys at all.
+ */
+
+/**/
+mod_export int
+sortcollmode(void)
+{
+#ifdef HAVE_STRCOLL
+# if defined(HAVE_SETLOCALE) && defined(LC_COLLATE)
+    char *loc = setlocale(LC_COLLATE, NULL);
+
+    if (!loc || !strcmp(loc, "C") || !strcmp(loc, "POSIX"))
+	return 1;
+# endif
+# ifdef HAVE_STRXFRM
+    return 2;
+# else
+    return 0;
+# endif
+#else
+    return 1;
+#endif
+}
+
+/*
+ * Return a key for the unmetafied string ustr to be compared
+ * with strcmp(), as from sortcollmode(); NULL if there isn't one.
+ * The key is on the heap.
+ */
+
+/**/
+mod_export char *
+sortcollkey(const char *ustr, int cmode)
+{
+#ifdef HAVE_STRXFRM
+    if (cmode == 2) {
+	char buf[256], *key;
+	size_t len = strxfrm(buf, ustr, sizeof(buf));
+
+	if (len == (size_t)-1)
+	    return NULL;
+	key = (char *)zhalloc(len + 1);
+	if (len < sizeof(buf))
+	    memcpy(key, buf, len + 1);
+	else
+	    strxfrm(key, ustr, len + 1);
+	return key;
+    }
+#endif
+    return cmode ? (char *)ustr : NULL;
+}
+
 /*
  * Sort an array of metafied strings.  Use an "or" of bit flags
  * to decide how to sort.  See the SORTIT_* flags in zsh.h.
@@ -230,7 +302,7 @@ strmetasort(char **array, int sortwhat, int *unmetalenp)
      */
     SortElt *sortptrarr, *sortptrarrptr;
     SortElt sortarr, sortarrptr;
-    int oldsortdir, oldsortnumeric, nsort;
+    int oldsortdir, oldsortnumeric, nsort, cmode, allkeys = 1;
 
     nsort = arrlen(array);
     if (nsort < 2)
@@ -238,6 +310,7 @@ strmetasort(char **array, int sortwhat, int *unmetalenp)
 
     pushheap();
 
+    cmode = sortcollmode();
     sortptrarr = (SortElt *) zhalloc(nsort * sizeof(SortElt));
     sortarr = (SortElt) zhalloc(nsort * sizeof(struct sortelt));
     for (arrptr = array, sortptrarrptr = sortptrarr, sortarrptr = sortarr;
@@ -381,6 +454,16 @@ strmetasort(char **array, int sortwhat, int *unmetalenp)
 	    sortarrptr->cmp = *arrptr;
 	    sortarrptr->len = needlen ? unmetalenp[arrptr-array] : -1;
 	}
+	/*
+	 * Transform the string for the locale once here rather
+	 * than in every comparison.
+	 */
+	if (sortarrptr->len == -1)
+	    sortarrptr->key = sortcollkey(sortarrptr->cmp, cmode);
+	else
+	    sortarrptr->key = NULL;
+	if (!sortarrptr->key)
+	    allkeys = 0;
     }
     /*
      * We probably don't need to restore the following, but it's pretty cheap.
@@ -391,7 +474,8 @@ strmetasort(char **array, int sortwhat, int *unmetalenp)
     sortdir = (sortwhat & SORTIT_BACKWARDS) ? -1 : 1;
     sortnumeric = (sortwhat & SORTIT_NUMERICALLY) ? 1 : 0;
 
-    qsort(sortptrarr, nsort, sizeof(SortElt), eltpcmp);
+    qsort(sortptrarr, nsort, sizeof(SortElt),
+	  (allkeys && !sortnumeric) ? eltpkeycmp : eltpcmp);
 
     sortnumeric = oldsortnumeric;
     sortdir = oldsortdir;
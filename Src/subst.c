@@ -101,7 +101,9 @@ prefork(LinkList list, int flags, int *ret_flags)
 {
     LinkNode node, insnode, stop = 0;
     int keep = 0, asssub = (flags & PREFORK_TYPESET) && isset(KSHTYPESET);
-    int ret_flags_local = 0;
+    int ret_flags_local = 0, minw;
+    zlong rstart, rstep;
+    zulong rcount;
     if (!ret_flags)
 	ret_flags = &ret_flags_local; /* will be discarded */
 
@@ -170,7 +172,14 @@ prefork(LinkList list, int flags, int *ret_flags)
 	    if (unset(IGNOREBRACES) && !(flags & PREFORK_SINGLE)) {
 		if (!keep)
 		    stop = nextnode(node);
-		while (hasbraces(getdata(node))) {
+		while (!errflag && hasbraces(getdata(node))) {
+		    if ((flags & PREFORK_RANGE) && !nextnode(node) &&
+			node == firstnode(list) &&
+			wordbracerange(getdata(node), &rstart, &rstep,
+				       &rcount, &minw)) {
+			*ret_flags |= PREFORK_RANGE;
+			break;
+		    }
 		    keep = 1;
 		    xpandbraces(list, &node);
 		}
@@ -3045,8 +3054,10 @@ paramsubst(LinkList l, LinkNode n, char **str, int qt, int pf_flags,
                              */
                             stopmsg = 1;
                             zexit(1, ZEXIT_NORMAL);
-                        } else
+                        } else {
+                            fflush(stdout);
                             _exit(1);
+                        }
                     }
                 }
 		return NULL;
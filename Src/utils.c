@@ -1397,10 +1397,9 @@ delprepromptfn(voidvoidfnptr_t func)
  * Timedfn.  The functions must be in time order, but this
  * is enforced by addtimedfn().
  *
- * Note on debugging:  the code in sched.c currently assumes it's
- * the only user of timedfns for the purposes of checking whether
- * there's a function on the list.  If this becomes no longer the case,
- * the DPUTS() tests in sched.c need rewriting.
+ * The users are sched and deferred history writes (see
+ * flushhistsave()), so code checking for its own entry
+ * must look for its function on the list.
  */
 
 /**/
@@ -1429,9 +1428,8 @@ addtimedfn(voidvoidfnptr_t func, time_t when)
 	 * want to insert the new data before the first element
 	 * with a greater time.
 	 *
-	 * In practice, the only use of timed functions is
-	 * sched, which only adds the one function; so this
-	 * whole branch isn't used beyond the following block.
+	 * Each user of timed functions only adds the one
+	 * function, so the list is never long.
 	 */
 	if (!ln) {
 	    zaddlinknode(timedfns, tfdat);
@@ -1463,8 +1461,7 @@ addtimedfn(voidvoidfnptr_t func, time_t when)
  * automatically delete the entry from the list.  That must
  * be done by the function called.  This is recommended as otherwise
  * the function will keep being called immediately.  (It just so
- * happens this "feature" fits in well with the only current use
- * of timed functions.)
+ * happens this "feature" fits in well with sched.)
  */
 
 /**/
@@ -2015,6 +2012,74 @@ check_fd_table(int fd)
     max_zsh_fd = fd;
 }
 
+/*
+ * Output from builtins to the shell's standard output is normally
+ * flushed at the end of each command.  When fd 1 is a plain file or a
+ * pipe that fd 2 doesn't also point to, nothing can tell the difference
+ * if we let stdio write it out in larger blocks instead; it is then
+ * flushed before forking, exec'ing, exiting, reading input, moving
+ * fd 1 or 2, or running any builtin other than print and its
+ * relatives, which may block waiting for whoever reads the output.
+ * It is never held beyond the end of a top-level list, or for more
+ * than about a second; see releasestdout().
+ * lazystdout is 1 if that's the case, 0 if not, and -1 if
+ * we need to look at the fds again.
+ */
+
+/**/
+int lazystdout = -1;
+
+/**/
+mod_export int
+stdoutlazy(void)
+{
+    if (lazystdout < 0) {
+	struct stat st1, st2;
+
+	lazystdout = !fstat(1, &st1) &&
+	    (S_ISREG(st1.st_mode) || S_ISFIFO(st1.st_mode)) &&
+	    (fstat(2, &st2) || st1.st_dev != st2.st_dev ||
+	     st1.st_ino != st2.st_ino);
+    }
+    return lazystdout;
+}
+
+/*
+ * The time output was first left in the buffer since it was last
+ * written, or 0 if nothing is held back.
+ */
+
+/**/
+time_t stdoutheld;
+
+/* Write out buffered standard output before fd 1 or 2 changes. */
+
+/**/
+mod_export int
+flushstdout(void)
+{
+    lazystdout = -1;
+    stdoutheld = 0;
+    return fflush(stdout);
+}
+
+/*
+ * Put a bound on how long output is held back, so that it isn't lost
+ * if the shell is killed and output from a long loop isn't delayed:
+ * called at the end of each sublist, it writes the output out at the
+ * end of a top-level list (force), else once it has waited a second.
+ */
+
+/**/
+void
+releasestdout(int force)
+{
+    if (stdoutheld && (force || time(NULL) > stdoutheld)) {
+	fflush(stdout);
+	stdoutheld = 0;
+    }
+}
+
 /* Move a fd to a place >= 10 and mark the new fd in fdtable.  If the fd *
  * is already >= 10, it is not moved.  If it is invalid, -1 is returned. */
 
@@ -2055,6 +2120,8 @@ redup(int x, int y)
 {
     int ret = y;
 
+    if (y == 1 || y == 2)
+	flushstdout();
     if(x < 0)
 	zclose(y);
     else if (x != y) {
@@ -5164,6 +5231,19 @@ ztrsub(char const *t, char const *s)
 /**/
 mod_export char *
 zreaddir(DIR *dir, int ignoredots)
+{
+    return zreaddirtype(dir, ignoredots, NULL);
+}
+
+/*
+ * As zreaddir(), but if typep is not NULL also store the file type
+ * bits (S_IFDIR etc.) for the entry if readdir() told us what they
+ * are, else 0.  Callers still need to stat if the type is 0.
+ */
+
+/**/
+mod_export char *
+zreaddirtype(DIR *dir, int ignoredots, mode_t *typep)
 {
     struct dirent *de;
 #if defined(HAVE_ICONV) && defined(__APPLE__)
@@ -5180,6 +5260,39 @@ zreaddir(DIR *dir, int ignoredots)
     } while(ignoredots && de->d_name[0] == '.' &&
 	(!de->d_name[1] || (de->d_name[1] == '.' && !de->d_name[2])));
 
+    if (typep) {
+	*typep = 0;
+#if defined(HAVE_STRUCT_DIRENT_D_TYPE) && defined(DT_UNKNOWN)
+	switch (de->d_type) {
+	case DT_REG:
+	    *typep = S_IFREG;
+	    break;
+	case DT_DIR:
+	    *typep = S_IFDIR;
+	    break;
+# ifdef S_IFLNK
+	case DT_LNK:
+	    *typep = S_IFLNK;
+	    break;
+# endif
+	case DT_FIFO:
+	    *typep = S_IFIFO;
+	    break;
+	case DT_CHR:
+	    *typep = S_IFCHR;
+	    break;
+	case DT_BLK:
+	    *typep = S_IFBLK;
+	    break;
+# ifdef S_IFSOCK
+	case DT_SOCK:
+	    *typep = S_IFSOCK;
+	    break;
+# endif
+	}
+#endif
+    }
+
 #if defined(HAVE_ICONV) && defined(__APPLE__)
     if (!conv_ds)
 	conv_ds = iconv_open("UTF-8", "UTF-8-MAC");
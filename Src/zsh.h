@@ -530,6 +530,7 @@ typedef struct features  *Features;
 typedef struct feature_enables  *Feature_enables;
 typedef struct funcstack *Funcstack;
 typedef struct funcwrap  *FuncWrap;
+typedef struct globdir   *Globdir;
 typedef struct hashnode  *HashNode;
 typedef struct hashtable *HashTable;
 typedef struct heap      *Heap;
@@ -2019,7 +2020,12 @@ enum {
      */
     PREFORK_KEY_VALUE     = 0x80,
     /* No untokenise: used only as flag to globlist */
-    PREFORK_NO_UNTOK      = 0x100
+    PREFORK_NO_UNTOK      = 0x100,
+    /*
+     * Leave a list that is a single numeric brace range unexpanded
+     * for the caller to step through.  Set on return if that happened.
+     */
+    PREFORK_RANGE         = 0x200
 };
 
 /*
@@ -2229,6 +2235,8 @@ struct histent {
 				/*   line:  as pairs of start, end  */
     int nwords;			/* Number of words in history line  */
     zlong histnum;		/* A sequential history number      */
+    zulong zle_sig;		/* Character pairs in the zle text, */
+				/*   valid if HIST_ZLESIG is set    */
 };
 
 #define HIST_MAKEUNIQUE	0x00000001	/* Kill this new entry if not unique */
@@ -2238,6 +2246,9 @@ struct histent {
 #define HIST_FOREIGN	0x00000010	/* Command came from another shell */
 #define HIST_TMPSTORE	0x00000020	/* Kill when user enters another cmd */
 #define HIST_NOWRITE	0x00000040	/* Keep internally but don't write */
+#define HIST_NOWORDS	0x00000080	/* Words not split yet: histentwords() */
+#define HIST_ZLESIG	0x00000100	/* zle_sig is up to date */
+#define HIST_INCHUNK	0x00000200	/* Text is in a chunk: histchunkdup() */
 
 #define GETHIST_UPWARD  (-1)
 #define GETHIST_DOWNWARD  1
@@ -2260,6 +2271,7 @@ struct histent {
 #define HFILE_SKIPFOREIGN	0x0008
 #define HFILE_FAST		0x0010
 #define HFILE_NO_REWRITE	0x0020
+#define HFILE_NO_LOCK		0x0040
 #define HFILE_USE_OPTIONS	0x8000
 
 /*
@@ -2407,8 +2419,10 @@ enum {
     GLOBALEXPORT,
     GLOBALRCS,
     GLOBASSIGN,
+    GLOBCACHE,
     GLOBCOMPLETE,
     GLOBDOTS,
+    GLOBPREFETCH,
     GLOBSTARSHORT,
     GLOBSUBST,
     HASHCMDS,
@@ -2417,12 +2431,14 @@ enum {
     HASHLISTALL,
     HISTALLOWCLOBBER,
     HISTBEEP,
+    HISTDEFERSAVE,
     HISTEXPIREDUPSFIRST,
     HISTFCNTLLOCK,
     HISTFINDNODUPS,
     HISTIGNOREALLDUPS,
     HISTIGNOREDUPS,
     HISTIGNORESPACE,
+    HISTJOURNAL,
     HISTLEXWORDS,
     HISTNOFUNCTIONS,
     HISTNOSTORE,
@@ -3027,6 +3043,11 @@ struct sortelt {
      * The length is only needed if there are embedded nulls.
      */
     int len;
+    /*
+     * If not NULL, a string that sorts with strcmp() the way cmp
+     * sorts with strcoll().  Only used if there are no embedded nulls.
+     */
+    const char *key;
 };
 
 typedef struct sortelt *SortElt;
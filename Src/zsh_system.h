@@ -170,6 +170,7 @@ char *alloca _((size_t));
 # define dirent direct
 # undef HAVE_STRUCT_DIRENT_D_INO
 # undef HAVE_STRUCT_DIRENT_D_STAT
+# undef HAVE_STRUCT_DIRENT_D_TYPE
 # ifdef HAVE_STRUCT_DIRECT_D_INO
 #  define HAVE_STRUCT_DIRENT_D_INO HAVE_STRUCT_DIRECT_D_INO
 # endif